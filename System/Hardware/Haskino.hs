@@ -15,7 +15,13 @@
 module System.Hardware.Haskino (
   -- * Communication functions
   openArduino, closeArduino, withArduino, send, ArduinoConnection
-  , withArduinoWeak, withArduinoApp
+  , withArduinoWeak, withArduinoApp, withArduinoWindow
+  , negotiateBaud, BaudRate(..)
+  , subscribePins, unsubscribePins, pauseSampling, resumeSampling, readPinSamples
+  , Subscription(..), SampleType(..)
+  , queryProtocolStats, ProtocolStats(..)
+  , queryTaskArena, ArenaStats(..)
+  , writeFlashBootImage, uploadTask
   , sendWeak, sendApp
   -- * Deep embeddings
   , Arduino(..) , ArduinoPrimitive(..), Processor(..)
@@ -41,10 +47,17 @@ module System.Hardware.Haskino (
   , millis, micros, millisE, microsE, delayMillis, delayMicros,delayMillisE, delayMicrosE
   -- ** Scheduler
   , TaskLength, TaskID, TimeMillis, TimeMicros, TaskPos, queryAllTasks, queryTask
-  , createTask, createTaskE
+  , createTask, createTaskE, swapTask, swapTaskE
   , deleteTask, scheduleTask, scheduleReset, queryTaskE
+  , queryTaskStats, queryTaskStatsE, TaskStats(..)
   , queryAllTasksE, deleteTaskE, scheduleTaskE, bootTaskE
+  , schedulePeriodic, schedulePeriodicE, queryOverruns, queryOverrunsE
+  , taskBudget, taskBudgetE
   , takeSem, giveSem, takeSemE, giveSemE, attachInt, attachIntE, detachInt, detachIntE
+  , takeSemTimed, takeSemTimedE, querySem, querySemE
+  , QueueValue, createQueue, createQueueE, sendQueue, sendQueueE
+  , trySendQueue, trySendQueueE, receiveQueue, receiveQueueE
+  , tryReceiveQueue, tryReceiveQueueE
   , interrupts, noInterrupts
   -- ** Stepper
   --, StepDevice, StepType(..), NumSteps, StepSpeed, StepAccel, StepPerRev
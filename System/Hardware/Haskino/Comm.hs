@@ -23,7 +23,7 @@ import           Control.Concurrent                (Chan, MVar, ThreadId,
                                                     forkIO, tryTakeMVar,
                                                     killThread, threadDelay)
 import           Control.Exception                 (tryJust, AsyncException(UserInterrupt))
-import           Control.Monad                     (when, forever)
+import           Control.Monad                     (when, forever, forM_)
 import           Control.Monad.State               (runState)
 import           Control.Monad.State               (liftIO)
 import           Control.Natural                   (wrapNT,unwrapNT)
@@ -35,6 +35,7 @@ import qualified Data.ByteString                   as B
 import           Data.IORef
 import           Data.List                         (intercalate)
 import qualified Data.Map                          as M
+import           Data.Word                         (Word8, Word16)
 import           System.Hardware.Haskino.Data
 import           System.Hardware.Haskino.Decode
 import           System.Hardware.Haskino.Expr
@@ -48,6 +49,7 @@ import qualified System.Hardware.Serialport        as S (openSerial, closeSerial
                                                          recv, send)
 import           System.IO.Error                   (tryIOError)
 import           System.Timeout                    (timeout)
+import           Text.Printf                       (printf)
 
 
 -- | Open the connection to control the board:
@@ -75,7 +77,9 @@ openArduino verbose fp = do
           error $ "\n*** Haskino:ERROR: Missing Port\n*** Make sure your Arduino is connected to " ++ fp
         Right port -> do
           dc <- newChan
-          tid <- setupListener port debugger dc
+          seqState <- newMVar $ SeqState 0 [] 0
+          sc <- newChan
+          tid <- setupListener port debugger dc seqState sc
           liftIO $ putMVar listenerTid tid
           refIndex <- newMVar 0
           refBMap <- newMVar M.empty
@@ -108,6 +112,8 @@ openArduino verbose fp = do
                            , refIMap       = refIMap
                            , refL8Map      = refL8Map
                            , refFloatMap   = refFloatMap
+                           , seqState      = seqState
+                           , sampleChannel = sc
                         }
           -- Step 0: Delay for 1 second after opeing serial port to allow Mega
           --    to funciton correctly, as opening the serial port while
@@ -173,6 +179,22 @@ withArduinoApp :: Bool       -- ^ If 'True', debugging info will be printed
                -> IO ()
 withArduinoApp = withArduinoMode sendApp
 
+-- | As 'withArduino', but using sequenced frames with up to the given
+-- number of frames in flight.
+withArduinoWindow :: Int        -- ^ Maximum number of unacked frames
+                  -> Bool       -- ^ If 'True', debugging info will be printed
+                  -> FilePath   -- ^ Path to the USB port
+                  -> Arduino a  -- ^ The Haskell controller program to run
+                  -> IO ()
+withArduinoWindow w = withArduinoMode (\c p -> setFrameWindow c w >> sendApp c p)
+
+-- | Switch the connection to sequenced frames, with up to the given
+-- number of frames in flight.  A window of 0 returns to plain frames.
+setFrameWindow :: ArduinoConnection -> Int -> IO ()
+setFrameWindow c w = do
+    st <- takeMVar (seqState c)
+    putMVar (seqState c) st {seqWindow = w}
+
 withArduinoMode :: (ArduinoConnection -> Arduino a -> IO a) -- ^ Send function
                 -> Bool       -- ^ If 'True', debugging info will be printed
                 -> FilePath   -- ^ Path to the USB port
@@ -211,9 +233,13 @@ runAP :: forall a . ArduinoConnection -> ApplicativePacket ArduinoPrimitive a ->
 runAP c pkt =
   case knownResult pkt of
     Just a -> do
-        cmds <- batchCommands c pkt B.empty
-        sendToArduino c cmds
+        cmds <- batchCommands c pkt (B.empty, [])
+        sendToArduino c (flushBatch cmds)
         return a
+    Nothing | batchedPacket pkt -> do
+        cmds <- batchCommands c pkt (B.empty, [])
+        sendToArduino c (flushBatch cmds)
+        collectReplies pkt
     Nothing -> case pkt of
                   AP.Primitive p -> case knownResult p of
                                       Just a -> do
@@ -224,17 +250,28 @@ runAP c pkt =
                   AP.Pure a      -> pure a
                   AP.Zip f g h   -> f <$> runAP c g <*> runAP c h
   where
-    batchCommands :: forall a' . ArduinoConnection -> ApplicativePacket ArduinoPrimitive a' -> B.ByteString -> IO B.ByteString
+    batchCommands :: forall a' . ArduinoConnection -> ApplicativePacket ArduinoPrimitive a' -> CommandBatch -> IO CommandBatch
     batchCommands c' pkt' cmds =
           case pkt' of
               AP.Primitive p -> case knownResult p of
-                                  Just _ -> frameCommand c' p cmds
+                                  Just _ -> batchCommand c' p cmds
+                                  Nothing | batchedProcedure p -> batchProcedure c' p cmds
                                   Nothing -> return cmds
               AP.Pure _      -> return cmds
               AP.Zip _ g h   -> do
                   gcmds <- batchCommands c' g cmds
                   hcmds <- batchCommands c' h gcmds
                   return hcmds
+    -- Replies to the procedures in a batch arrive in the order the
+    -- procedures were sent, either framed separately or coalesced.
+    collectReplies :: forall a' . ApplicativePacket ArduinoPrimitive a' -> IO a'
+    collectReplies pkt' =
+          case pkt' of
+              AP.Primitive p -> case knownResult p of
+                                  Just a  -> return a
+                                  Nothing -> waitResponse c (procDelay p) p
+              AP.Pure a      -> pure a
+              AP.Zip f g h   -> f <$> collectReplies g <*> collectReplies h
 
 frameCommand :: ArduinoConnection -> ArduinoPrimitive a -> B.ByteString -> IO B.ByteString
 frameCommand c (Loop m) cmds = do
@@ -243,11 +280,70 @@ frameCommand c (Loop m) cmds = do
 frameCommand c (CreateTaskE tid as) cmds= do
     pc <- packageCommandIndex c (CreateTaskE tid as)
     return $ B.append cmds pc
+frameCommand c (SwapTaskE tid as k) cmds= do
+    pc <- packageCommandIndex c (SwapTaskE tid as k)
+    return $ B.append cmds pc
 frameCommand c cmd cmds= do
     pc <- packageCommandIndex c cmd
     checkPackageLength c pc
     return $ B.append cmds (framePackage pc)
 
+-- | Framed commands, followed by unframed commands (most recent first)
+-- waiting to be combined into batch frames.
+type CommandBatch = (B.ByteString, [B.ByteString])
+
+batchCommand :: ArduinoConnection -> ArduinoPrimitive a -> CommandBatch -> IO CommandBatch
+batchCommand c (Loop m) cmds = do
+    frame <- frameCommand c (Loop m) (flushBatch cmds)
+    return (frame, [])
+batchCommand c (CreateTaskE tid as) cmds = do
+    frame <- frameCommand c (CreateTaskE tid as) (flushBatch cmds)
+    return (frame, [])
+batchCommand c (SwapTaskE tid as k) cmds = do
+    frame <- frameCommand c (SwapTaskE tid as k) (flushBatch cmds)
+    return (frame, [])
+batchCommand c cmd (frames, pending) = do
+    pc <- packageCommandIndex c cmd
+    checkPackageLength c pc
+    return (frames, pc : pending)
+
+batchProcedure :: ArduinoConnection -> ArduinoPrimitive a -> CommandBatch -> IO CommandBatch
+batchProcedure c procedure (frames, pending) = do
+    let (pc, _) = runState (packageProcedure procedure) (CommandState 0 0 B.empty [] False [] [])
+    checkPackageLength c pc
+    return (frames, pc : pending)
+
+-- | Packets made up of commands and simple query procedures are sent as
+-- batch frames, so that the firmware may coalesce the replies.
+batchedPacket :: ApplicativePacket ArduinoPrimitive a -> Bool
+batchedPacket (AP.Primitive p) = case knownResult p of
+                                   Just _  -> True
+                                   Nothing -> batchedProcedure p
+batchedPacket (AP.Pure _)      = True
+batchedPacket (AP.Zip _ g h)   = batchedPacket g && batchedPacket h
+
+batchedProcedure :: ArduinoPrimitive a -> Bool
+batchedProcedure QueryFirmware           = True
+batchedProcedure QueryFirmwareE          = True
+batchedProcedure QueryProcessor          = True
+batchedProcedure QueryProcessorE         = True
+batchedProcedure Micros                  = True
+batchedProcedure MicrosE                 = True
+batchedProcedure Millis                  = True
+batchedProcedure MillisE                 = True
+batchedProcedure (DigitalRead _)         = True
+batchedProcedure (DigitalReadE _)        = True
+batchedProcedure (DigitalPortRead _ _)   = True
+batchedProcedure (DigitalPortReadE _ _)  = True
+batchedProcedure (AnalogRead _)          = True
+batchedProcedure (AnalogReadE _)         = True
+batchedProcedure (I2CRead _ _)           = True
+batchedProcedure (I2CReadE _ _)          = True
+batchedProcedure _                       = False
+
+flushBatch :: CommandBatch -> B.ByteString
+flushBatch (frames, pending) = B.append frames (batchPackage $ reverse pending)
+
 sendProcedureCmds :: ArduinoConnection -> ArduinoPrimitive a -> B.ByteString -> IO a
 sendProcedureCmds c (Debug msg) cmds = do
     message c $ bytesToString msg
@@ -361,16 +457,74 @@ sendToArduino conn cmds = do
     when (lp /= 0)
          -- (message conn $ "Sending: " ++ show (encode cmds))
          (message conn $ "Sending: \n" ++ (decodeFrame cmds))
-    sent <- liftIO $ S.send (port conn) cmds
+    st <- readMVar (seqState conn)
+    if seqWindow st == 0
+    then sendFrames conn cmds
+    else mapM_ (sendSeqFrame conn) (deframe cmds)
+  where
+    lp = B.length cmds
+
+sendFrames :: ArduinoConnection -> B.ByteString -> IO ()
+sendFrames conn frames = do
+    sent <- liftIO $ S.send (port conn) frames
     when (sent /= lp)
          (message conn $ "Send failed. Tried: " ++ show lp ++ "bytes, reported: " ++ show sent)
   where
-    lp = B.length cmds
+    lp = B.length frames
+
+-- | Time to wait for an ack before unacked frames are retransmitted
+seqRetryTime :: Int
+seqRetryTime = millisToMicros 100
+
+-- | Send a sequenced frame once there is room in the window, keeping it
+-- until it is acked in case it must be retransmitted.
+sendSeqFrame :: ArduinoConnection -> B.ByteString -> IO ()
+sendSeqFrame conn payload = do
+    waitWindow 0
+    st <- takeMVar (seqState conn)
+    let s     = seqNext st
+        frame = seqFramePackage s payload
+    sendFrames conn frame
+    putMVar (seqState conn) st {seqNext = s + 1, seqUnacked = seqUnacked st ++ [(s, frame)]}
+  where
+    waitWindow :: Int -> IO ()
+    waitWindow waited = do
+        st <- readMVar (seqState conn)
+        when (length (seqUnacked st) >= seqWindow st) $
+            if waited >= seqRetryTime
+            then do retransmitFrames (port conn) (seqState conn)
+                    waitWindow 0
+            else do threadDelay 1000
+                    waitWindow (waited + 1000)
+
+-- | Resend every unacked frame, in order.  This is go-back-N rather than
+-- selective repeat, as the firmware keeps no frames out of order: it
+-- drops the frames after a gap, and its nak only names the last frame it
+-- executed, so all of those after it must be resent.  Replies are not
+-- sequenced, so a lost reply is only found by 'waitResponse' timing out.
+retransmitFrames :: SerialPort -> MVar SeqState -> IO ()
+retransmitFrames p sv = do
+    st <- takeMVar sv
+    mapM_ (S.send p . snd) (seqUnacked st)
+    putMVar sv st
+
+-- | Release the frames covered by an ack, and limit the window to what
+-- the firmware will accept.
+ackFrames :: MVar SeqState -> Word8 -> Word8 -> IO ()
+ackFrames sv a w = do
+    st <- takeMVar sv
+    let unacked = seqUnacked st
+        acked = case unacked of
+                  []         -> 0
+                  (s, _) : _ -> fromIntegral (a + 1 - s)
+        acked' = if acked > length unacked then 0 else acked
+    putMVar sv st {seqUnacked = drop acked' unacked,
+                   seqWindow  = min (seqWindow st) (fromIntegral w)}
 
 waitResponse :: ArduinoConnection -> Int -> ArduinoPrimitive a -> IO a
 waitResponse c t procedure = do
   message c $ "Waiting for response"
-  resp <- liftIO $ timeout t $ readChan $ deviceChannel c
+  resp <- readResponse c t
   case resp of
       Nothing -> runDie c "Haskino:ERROR: Response Timeout"
                        [ "Make sure your Arduino is running Haskino Firmware"]
@@ -385,6 +539,276 @@ waitResponse c t procedure = do
                             waitResponse c t procedure
               Just qr -> return qr
 
+-- | Ask the firmware to change from one baud rate to another, and once
+-- it has agreed, switch the host port with the given action.  The new
+-- rate is confirmed with a firmware version query.  If that fails, both
+-- the host and the firmware fall back to the old rate.
+--
+-- The serialport package used for the connection cannot set any rate
+-- above 115200, so Haskino has no action of its own which switches the
+-- host port to 'Baud500000' or faster.  The action must set the rate by
+-- other means, such as running @stty -F \/dev\/ttyACM0 1000000@ on
+-- Linux.  If it cannot, the confirmation fails and False is returned
+-- with both sides back at the old rate.
+negotiateBaud :: ArduinoConnection -> BaudRate -> BaudRate -> (BaudRate -> IO ()) -> IO Bool
+negotiateBaud c old new switch = do
+    sendToArduino c $ framePackage $ B.pack $ firmwareCmdVal BC_CMD_SET_BAUD : 0 :
+                                              packageExpr (LitW8 $ fromIntegral $ fromEnum new)
+    agreed <- waitForResponse c (secsToMicros 1) isSetBaud
+    case agreed of
+      Just (SetBaudReply True) -> do
+          switch new
+          sendToArduino c $ framePackage $ B.pack [firmwareCmdVal BS_CMD_REQUEST_VERSION, 0]
+          confirmed <- waitForResponse c baudConfirmTime isFirmware
+          case confirmed of
+            Just _  -> return True
+            Nothing -> do
+              message c $ "Baud rate " ++ show new ++ " failed, returning to " ++ show old
+              switch old
+              -- Wait for the firmware to give up on the new rate as well
+              threadDelay $ millisToMicros 1000
+              return False
+      _ -> return False
+  where
+    -- Time to wait for the confirmation at the new rate, which must be
+    -- shorter than the firmware BAUD_CONFIRM_MILLIS.
+    baudConfirmTime = millisToMicros 250
+
+    isSetBaud (SetBaudReply _) = True
+    isSetBaud _                = False
+    isFirmware (Firmware _)    = True
+    isFirmware _               = False
+
+-- | Wait for a response matching the predicate, dropping any others,
+-- or until no response has arrived for the timeout.
+waitForResponse :: ArduinoConnection -> Int -> (Response -> Bool) -> IO (Maybe Response)
+waitForResponse c t match = do
+    resp <- timeout t $ readChan $ deviceChannel c
+    case resp of
+      Just r | match r -> return resp
+             | True    -> waitForResponse c t match
+      Nothing          -> return Nothing
+
+-- | Query the firmware protocol counters and command latency histograms,
+-- optionally resetting them once read.  Returns 'Nothing' if the
+-- firmware was built without INCLUDE_PROTOCOL_STATS, which is left out by
+-- default on boards with 4K of SRAM or less, such as the Uno.
+queryProtocolStats :: ArduinoConnection -> Bool -> IO (Maybe ProtocolStats)
+queryProtocolStats c reset = do
+    sendToArduino c $ framePackage $ B.pack $ firmwareCmdVal BS_CMD_STATS : 0 :
+                                              packageExpr (LitB reset)
+    resp <- waitForResponse c (secsToMicros 1) isStats
+    case resp of
+      Just (StatsReply s) -> return s
+      _                   -> return Nothing
+  where
+    isStats (StatsReply _) = True
+    isStats _              = False
+
+-- | Query how much of the firmware task arena is in use, and how many
+-- task creations it has refused.
+queryTaskArena :: ArduinoConnection -> IO (Maybe ArenaStats)
+queryTaskArena c = do
+    sendToArduino c $ framePackage $ B.pack [firmwareCmdVal BS_CMD_ARENA_STATS, 0]
+    resp <- waitForResponse c (secsToMicros 1) isArena
+    case resp of
+      Just (ArenaReply s) -> return s
+      _                   -> return Nothing
+  where
+    isArena (ArenaReply _) = True
+    isArena _              = False
+
+-- | Create a task, and upload its code in stream frames, which the
+-- firmware writes straight into the task rather than dispatching as
+-- commands, so the code is not split into 'addToTask' commands of less
+-- than a frame each.  Frames are sent up to the window the firmware acks
+-- with, and are retransmitted from the first lost frame on a nak or a
+-- timeout.  The firmware checks a CRC over the whole of the code once it
+-- has arrived.  Returns whether the task was uploaded intact, after which
+-- it is scheduled as any other task.
+uploadTask :: ArduinoConnection -> TaskID -> Arduino () -> IO Bool
+uploadTask c tid m = do
+    sendToArduino c $ framePackage $ B.pack $ firmwareCmdVal SCHED_CMD_DELETE_TASK :
+                                              packageExpr (LitW8 tid)
+    sendToArduino c $ framePackage $ B.pack $ firmwareCmdVal SCHED_CMD_CREATE_TASK :
+        (packageExpr (LitW8 tid) ++ packageExpr (LitW16 len) ++
+         packageExpr (LitW16 (fromIntegral (ib s))))
+    sendToArduino c $ framePackage $ B.pack $ firmwareCmdVal SCHED_CMD_STREAM_TASK :
+        (packageExpr (LitW8 tid) ++ packageExpr (LitW16 len) ++
+         packageExpr (LitW16 (crc16 td)))
+    -- The stream is open once the firmware acks the frame before the first
+    opened <- waitForResponse c (secsToMicros 1) isStream
+    case opened of
+      Just (StreamAck _ w) -> sendChunks (fromIntegral w) 0 0
+      _                    -> return False
+  where
+    ((_, td, _), s) = runState (packageCodeBlock m) (CommandState 0 0 B.empty [] False [] [])
+    len = fromIntegral $ B.length td
+    chunks = chunk td
+    total = length chunks
+
+    -- Chunks from base on are unacked, and those before sent have been sent
+    sendChunks :: Int -> Int -> Int -> IO Bool
+    sendChunks w base sent
+      | base >= total = waitEnd
+      | otherwise = do
+          let upto = min total (base + w)
+          forM_ [sent .. upto - 1] $ \n ->
+              sendFrames c $ streamFramePackage (fromIntegral n) (chunks !! n)
+          resp <- waitForResponse c streamRetryTime isStream
+          case resp of
+            Just (StreamAck a _)     -> sendChunks w (acked w base a) (max sent upto)
+            Just (StreamNak a _)     -> let base' = acked w base a
+                                        in sendChunks w base' base'
+            Just (StreamEndReply ok) -> return ok
+            _                        -> sendChunks w base base
+
+    -- Acks carry the 8 bit sequence number of the last frame written
+    acked :: Int -> Int -> Word8 -> Int
+    acked w base a = let n = fromIntegral (a + 1 - fromIntegral base)
+                     in if n <= w then base + n else base
+
+    waitEnd = do
+        resp <- waitForResponse c (secsToMicros 1) isEnd
+        case resp of
+          Just (StreamEndReply ok) -> return ok
+          _                        -> return False
+
+    chunk bs | B.null bs = []
+             | otherwise = B.take streamChunkSize bs : chunk (B.drop streamChunkSize bs)
+
+    -- Stream frames hold the header and sequence number, the code, and
+    -- the CRC
+    streamChunkSize = maxFirmwareSize - 4
+    streamRetryTime = millisToMicros 100
+
+    isStream (StreamAck _ _)    = True
+    isStream (StreamNak _ _)    = True
+    isStream (StreamEndReply _) = True
+    isStream _                  = False
+    isEnd (StreamEndReply _)    = True
+    isEnd _                     = False
+
+-- | Write a C header holding a boot image of the given tasks, for
+-- firmware built with BOOT_IMAGE_FLASH, which runs them in place from
+-- program flash rather than copying them into SRAM.  Each task is given
+-- with its id, and the time in milliseconds after boot at which it is
+-- first run.  The header replaces HaskinoBootImage.h in the firmware.
+-- The firmware copies each command into a 64 byte stage in SRAM to run
+-- it, or just the part before the code block of an iterate or if, so an
+-- IO error is raised, and no header written, if any task has a command
+-- or such a part which is longer.
+writeFlashBootImage :: FilePath -> [(TaskID, TimeMillis, Arduino ())] -> IO ()
+writeFlashBootImage fp tasks =
+    case [tid | (tid, _, m) <- tasks, not (stageFits $ fst $ taskCode m)] of
+      []  -> writeFile fp $ unlines $
+                [ "// Haskino boot tasks, run in place from flash"
+                , "static const byte bootImageFlash[] PROGMEM = {" ] ++
+                map (("    " ++) . (++ ",") . intercalate ", " . map hexByte) (chunk image) ++
+                [ "    };" ]
+      bad -> ioError $ userError $ "writeFlashBootImage: Tasks " ++ show bad ++
+                                   " have commands too long to stage"
+  where
+    image = fromIntegral (length tasks) : concatMap taskImage tasks
+    -- Each task is a record laid out as BOOT_RECORD in the firmware,
+    -- followed by its unpacked body.
+    taskImage (tid, start, m) =
+        let (td, binds) = taskCode m
+            len = word16ToBytes $ fromIntegral $ B.length td
+        in tid : 0 : len ++ word16ToBytes (fromIntegral binds) ++ len ++
+           word32ToBytes start ++ B.unpack td
+    taskCode m =
+        let ((_, td, _), s) = runState (packageCodeBlock m)
+                                       (CommandState 0 0 B.empty [] False [] [])
+        in (td, ib s)
+    -- CODE_STAGE_SIZE in the firmware
+    codeStageSize = 64
+    stageFits bs
+      | B.null bs = True
+      | otherwise = cmdFits cmd && stageFits rest
+      where
+        (cmd, rest) = splitCommand bs
+    -- Command lengths are one byte, or 0xFF and a 16 bit length
+    splitCommand bs
+      | B.head bs /= 0xFF = B.splitAt (fromIntegral $ B.head bs) (B.drop 1 bs)
+      | otherwise         = B.splitAt (fromIntegral (B.index bs 1) +
+                                       256 * fromIntegral (B.index bs 2))
+                                      (B.drop 3 bs)
+    cmdFits cmd
+      | B.length cmd <= codeStageSize = True
+      | op == firmwareCmdVal BC_CMD_ITERATE =
+          blockFits (5 + fromIntegral (B.index cmd 4))
+      | op == firmwareCmdVal BC_CMD_IF_THEN_ELSE =
+          blockFits (B.length cmd - B.length (snd $ decodeExpr $ B.drop 6 cmd))
+      | otherwise = False
+      where
+        op = B.head cmd
+        blockFits hdr = hdr <= codeStageSize && stageFits (B.drop hdr cmd)
+    hexByte :: Word8 -> String
+    hexByte = printf "0x%02x"
+    chunk [] = []
+    chunk bs = take 12 bs : chunk (drop 12 bs)
+
+-- | Register pin sampling subscriptions, numbered from slot 0 in list
+-- order.  The firmware then pushes samples without being asked, which
+-- are read with 'readPinSamples'.  The firmware has 8 slots, or 4 on
+-- boards with 4K of SRAM or less, and ignores subscriptions beyond them.
+subscribePins :: ArduinoConnection -> [Subscription] -> IO ()
+subscribePins c subs =
+    forM_ (zip [0..] subs) $ \(slot, Subscription p t per d) ->
+        sendToArduino c $ framePackage $ B.pack $ firmwareCmdVal DIG_CMD_SUBSCRIBE :
+            (packageExpr (LitW8 slot) ++ packageExpr (LitW8 p) ++
+             packageExpr (LitB (t == AnalogSample)) ++ packageExpr (LitW16 per) ++
+             packageExpr (LitW8 d))
+
+-- | Remove all pin sampling subscriptions.
+unsubscribePins :: ArduinoConnection -> IO ()
+unsubscribePins c =
+    sendToArduino c $ framePackage $ B.pack $ firmwareCmdVal DIG_CMD_UNSUBSCRIBE :
+        packageExpr (LitW8 allSubscriptions)
+
+-- | Pause sampling of one subscription slot, or of all of them if no
+-- slot is given.
+pauseSampling :: ArduinoConnection -> Maybe Word8 -> IO ()
+pauseSampling c slot = setSampling c slot False
+
+-- | Resume sampling paused with 'pauseSampling'.  Samples missed while
+-- paused are not caught up.
+resumeSampling :: ArduinoConnection -> Maybe Word8 -> IO ()
+resumeSampling c slot = setSampling c slot True
+
+setSampling :: ArduinoConnection -> Maybe Word8 -> Bool -> IO ()
+setSampling c slot b =
+    sendToArduino c $ framePackage $ B.pack $ firmwareCmdVal DIG_CMD_SAMPLING :
+        (packageExpr (LitW8 $ maybe allSubscriptions id slot) ++ packageExpr (LitB b))
+
+allSubscriptions :: Word8
+allSubscriptions = 0xFF
+
+-- | Wait for the next frame of pushed samples, returning the firmware
+-- millis time it was taken at, and (slot, value) for each sample.
+readPinSamples :: ArduinoConnection -> IO (TimeMillis, [(Word8, Word16)])
+readPinSamples c = do
+    resp <- readChan $ sampleChannel c
+    case resp of
+      PinSamples t ss -> return (t, ss)
+      _               -> readPinSamples c
+
+-- | Wait for a response.  With sequenced frames, the wait is split into
+-- retry periods, and unacked frames are retransmitted after each period
+-- in case the frame the response depends on was lost.
+readResponse :: ArduinoConnection -> Int -> IO (Maybe Response)
+readResponse c t = do
+    st <- readMVar (seqState c)
+    if seqWindow st == 0 || t <= seqRetryTime
+    then timeout t $ readChan $ deviceChannel c
+    else do
+        resp <- timeout seqRetryTime $ readChan $ deviceChannel c
+        case resp of
+          Nothing -> do retransmitFrames (port c) (seqState c)
+                        readResponse c (t - seqRetryTime)
+          _       -> return resp
+
 procDelay :: ArduinoPrimitive a -> Int
 procDelay proc =
   case proc of
@@ -406,8 +830,8 @@ secsToMicros :: Int -> Int
 secsToMicros s = s * 1000000
 
 -- | Start a thread to listen to the board and populate the channel with incoming queries.
-setupListener :: SerialPort -> (String -> IO ()) -> Chan Response -> IO ThreadId
-setupListener serial dbg chan = do
+setupListener :: SerialPort -> (String -> IO ()) -> Chan Response -> MVar SeqState -> Chan Response -> IO ThreadId
+setupListener serial dbg chan seqs samples = do
         let getByte = do bs <- S.recv serial 1
                          case B.length bs of
                             0 -> getByte
@@ -420,21 +844,33 @@ setupListener serial dbg chan = do
                                                  collectFrame ((xor e 0x20) : sofar)
                                       _    -> collectFrame (b : sofar)
             checkFrame fs = (last fs) == (foldl (+) 0 $ init fs)
+            -- A batch reply holds several replies, each preceded by its
+            -- length, which are delivered as if they were framed separately.
+            splitBatch []       = []
+            splitBatch (l : rs) = take (fromIntegral l) rs : splitBatch (drop (fromIntegral l) rs)
+            unpackageReply fs = case getFirmwareReply $ head fs of
+                                  Left  unknown       -> [Unimplemented (Just (show unknown)) []]
+                                  Right BC_RESP_BATCH -> map unpackageResponse $ splitBatch $ tail fs
+                                  Right _             -> [unpackageResponse fs]
             listener = do
                 frame  <- collectFrame []
-                resp <- case frame of
-                           [] -> return $ EmptyFrame
-                           fs | not (checkFrame fs) -> return $ InvalidChecksumFrame fs
-                           fs -> case getFirmwareReply $ head fs of
-                                    Left  unknown  -> return $ Unimplemented (Just (show unknown)) []
-                                    Right _        -> return $ unpackageResponse $ init fs
-                case resp of
-                  EmptyFrame             -> dbg $ "Ignoring empty received frame"
-                  InvalidChecksumFrame{} -> dbg $ "Ignoring received frame with invalid checksum" ++ show resp
-                  Unimplemented{}        -> dbg $ "Ignoring the received response: " ++ show resp
-                  StringMessage{}        -> dbg $ "Received " ++ show resp
-                  _                      -> do dbg $ "Received " ++ show resp
-                                               writeChan chan resp
+                resps <- case frame of
+                           [] -> return [EmptyFrame]
+                           fs | not (checkFrame fs) -> return [InvalidChecksumFrame fs]
+                           fs -> return $ unpackageReply $ init fs
+                forM_ resps $ \resp ->
+                  case resp of
+                    EmptyFrame             -> dbg $ "Ignoring empty received frame"
+                    InvalidChecksumFrame{} -> dbg $ "Ignoring received frame with invalid checksum" ++ show resp
+                    Unimplemented{}        -> dbg $ "Ignoring the received response: " ++ show resp
+                    StringMessage{}        -> dbg $ "Received " ++ show resp
+                    SeqAck a w             -> ackFrames seqs a w
+                    SeqNak a w             -> do dbg $ "Received " ++ show resp
+                                                 ackFrames seqs a w
+                                                 retransmitFrames serial seqs
+                    PinSamples{}           -> writeChan samples resp
+                    _                      -> do dbg $ "Received " ++ show resp
+                                                 writeChan chan resp
         _ <- S.recv serial maxFirmwareSize -- Clear serial port of any unneeded characters
         tid <- liftIO $ forkIO $ forever listener
         return tid
@@ -308,11 +308,26 @@ compileCommand (CreateTaskE (LitW8 tid) m) = do
     s <- get
     put s {tasksToDo = (m, taskName, False) : (tasksToDo s)}
     return LitUnit
+compileCommand (SwapTask tid _ _) = do
+    _ <- compileShallowPrimitiveError $ "swapTask " ++ show tid
+    return ()
+compileCommand (SwapTaskE _ _ _) =
+    compileUnsupportedError "swapTaskE"
 compileCommand (ScheduleTask tid m) = do
     _ <- compileShallowPrimitiveError $ "scheduleTask " ++ show tid ++ " " ++ show m
     return ()
 compileCommand (ScheduleTaskE tid tt) =
     compile2ExprCommand "scheduleTask" tid tt
+compileCommand (SchedulePeriodic tid tt p) = do
+    _ <- compileShallowPrimitiveError $ "schedulePeriodic " ++ show tid ++ " " ++ show tt ++ " " ++ show p
+    return ()
+compileCommand (SchedulePeriodicE _ _ _) =
+    compileUnsupportedError "schedulePeriodicE"
+compileCommand (TaskBudget tid b) = do
+    _ <- compileShallowPrimitiveError $ "taskBudget " ++ show tid ++ " " ++ show b
+    return ()
+compileCommand (TaskBudgetE _ _) =
+    compileUnsupportedError "taskBudgetE"
 compileCommand ScheduleReset = do
     _ <- compileShallowPrimitiveError $ "scheduleReset"
     return ()
@@ -348,6 +363,11 @@ compileCommand (GiveSemE i) =
     compile1ExprCommand "giveSem" i
 compileCommand (TakeSemE i) =
     compile1ExprCommand "takeSem" i
+compileCommand (CreateQueue q n) = do
+    _ <- compileShallowPrimitiveError $ "createQueue " ++ show q ++ " " ++ show n
+    return ()
+compileCommand (CreateQueueE _ _) =
+    compileUnsupportedError "createQueueE"
 compileCommand (WriteRemoteRefB (RemoteRefB i) e) = do
   compileShallowPrimitiveError "writeRemoteRefB"
   return ()
@@ -643,6 +663,42 @@ compileProcedure (QueryTaskE _) = do
 compileProcedure (QueryTask _) = do
     _ <- compileUnsupportedError "queryTask"
     return Nothing
+compileProcedure (QueryTaskStatsE _) = do
+    _ <- compileUnsupportedError "queryTaskStatsE"
+    return Nothing
+compileProcedure (QueryTaskStats _) = do
+    _ <- compileUnsupportedError "queryTaskStats"
+    return Nothing
+compileProcedure (QueryOverruns _) = do
+    _ <- compileUnsupportedError "queryOverruns"
+    return 0
+compileProcedure (QueryOverrunsE _) = do
+    _ <- compileUnsupportedError "queryOverrunsE"
+    return $ lit 0
+compileProcedure (TakeSemTimed _ _) = do
+    _ <- compileUnsupportedError "takeSemTimed"
+    return False
+compileProcedure (TakeSemTimedE _ _) = do
+    _ <- compileUnsupportedError "takeSemTimedE"
+    return false
+compileProcedure (QuerySem _) = do
+    _ <- compileUnsupportedError "querySem"
+    return Nothing
+compileProcedure (QuerySemE _) = do
+    _ <- compileUnsupportedError "querySemE"
+    return Nothing
+compileProcedure (QueueSend _ _ _) = do
+    _ <- compileUnsupportedError "sendQueue"
+    return False
+compileProcedure (QueueSendE _ _ _) = do
+    _ <- compileUnsupportedError "sendQueueE"
+    return false
+compileProcedure (QueueReceive _ _ d) = do
+    _ <- compileUnsupportedError "receiveQueue"
+    return d
+compileProcedure (QueueReceiveE _ _ d) = do
+    _ <- compileUnsupportedError "receiveQueueE"
+    return d
 compileProcedure (BootTaskE _) = do
     _ <- compileUnsupportedError "bootTaskE"
     return true
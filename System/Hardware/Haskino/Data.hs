@@ -26,6 +26,7 @@ module System.Hardware.Haskino.Data where
 import           Control.Concurrent           (Chan, MVar, ThreadId)
 import           Control.Monad.Trans
 import           Control.Remote.Monad
+import qualified Data.ByteString              as B
 import           Data.Int                     (Int8, Int16, Int32)
 import           Data.IORef
 import qualified Data.Map                     as M
@@ -33,6 +34,8 @@ import           Data.Word                    (Word8, Word16, Word32)
 import           System.Hardware.Serialport   (SerialPort)
 
 import           System.Hardware.Haskino.Expr
+import           System.Hardware.Haskino.Utils (bytesToWord16, bytesToWord32,
+                                                bytesToInt32, bytesToFloat)
 
 -----------------------------------------------------------------------------
 
@@ -82,6 +85,16 @@ data ArduinoConnection = ArduinoConnection {
               , refIMap       :: MVar (M.Map Int (IORef Int))         -- ^ Mapping of Word32 RemoteRef -> IORef
               , refL8Map      :: MVar (M.Map Int (IORef [Word8]))     -- ^ Mapping of [Word8] RemoteRef -> IORef
               , refFloatMap   :: MVar (M.Map Int (IORef Float))       -- ^ Mapping of Float RemoteRef -> IORef
+              , seqState      :: MVar SeqState                        -- ^ Sequenced frame transmit state
+              , sampleChannel :: Chan Response                        -- ^ Pin samples pushed by the board
+              }
+
+-- | State of the sequenced frame protocol.  A window of 0 disables
+-- sequenced frames, otherwise up to 'seqWindow' frames may be unacked.
+data SeqState = SeqState {
+                seqNext       :: Word8                                -- ^ Sequence number of the next frame
+              , seqUnacked    :: [(Word8, B.ByteString)]              -- ^ Frames sent but not yet acked, oldest first
+              , seqWindow     :: Int                                  -- ^ Maximum number of unacked frames
               }
 
 type SlaveAddress = Word8
@@ -119,10 +132,16 @@ data ArduinoPrimitive :: * -> * where
      ServoWriteMicrosE    :: Expr Word8 -> Expr Int16          -> ArduinoPrimitive (Expr ())
      CreateTask           :: TaskID     -> Arduino ()          -> ArduinoPrimitive ()
      CreateTaskE          :: TaskIDE    -> Arduino (Expr ())   -> ArduinoPrimitive (Expr ())
+     SwapTask             :: TaskID     -> Arduino ()  -> Bool      -> ArduinoPrimitive ()
+     SwapTaskE            :: TaskIDE    -> Arduino (Expr ()) -> Expr Bool -> ArduinoPrimitive (Expr ())
      DeleteTask           :: TaskID                            -> ArduinoPrimitive ()
      DeleteTaskE          :: TaskIDE                           -> ArduinoPrimitive (Expr ())
      ScheduleTask         :: TaskID     -> TimeMillis          -> ArduinoPrimitive ()
      ScheduleTaskE        :: TaskIDE    -> TimeMillisE         -> ArduinoPrimitive (Expr ())
+     SchedulePeriodic     :: TaskID  -> TimeMillis  -> TimeMicros  -> ArduinoPrimitive ()
+     SchedulePeriodicE    :: TaskIDE -> TimeMillisE -> TimeMicrosE -> ArduinoPrimitive (Expr ())
+     TaskBudget           :: TaskID     -> TimeMicros          -> ArduinoPrimitive ()
+     TaskBudgetE          :: TaskIDE    -> TimeMicrosE         -> ArduinoPrimitive (Expr ())
      ScheduleReset        ::                                      ArduinoPrimitive ()
      ScheduleResetE       ::                                      ArduinoPrimitive (Expr ())
      AttachInt            :: Pin  -> TaskID  -> Expr Word8     -> ArduinoPrimitive ()
@@ -137,6 +156,8 @@ data ArduinoPrimitive :: * -> * where
      GiveSemE             :: Expr Word8                        -> ArduinoPrimitive (Expr ())
      TakeSem              :: Word8                             -> ArduinoPrimitive ()
      TakeSemE             :: Expr Word8                        -> ArduinoPrimitive (Expr ())
+     CreateQueue          :: Word8 -> Word8                    -> ArduinoPrimitive ()
+     CreateQueueE         :: Expr Word8 -> Expr Word8          -> ArduinoPrimitive (Expr ())
      WriteRemoteRefB      :: RemoteRef Bool    -> Bool    -> ArduinoPrimitive ()
      WriteRemoteRefBE     :: RemoteRef Bool    -> Expr Bool    -> ArduinoPrimitive (Expr ())
      WriteRemoteRefW8     :: RemoteRef Word8   -> Word8   -> ArduinoPrimitive ()
@@ -213,6 +234,18 @@ data ArduinoPrimitive :: * -> * where
      QueryAllTasksE       :: ArduinoPrimitive (Expr [TaskID])
      QueryTask            :: TaskID -> ArduinoPrimitive (Maybe (TaskLength, TaskLength, TaskPos, TimeMillis))
      QueryTaskE           :: TaskIDE -> ArduinoPrimitive (Maybe (TaskLength, TaskLength, TaskPos, TimeMillis))
+     QueryTaskStats       :: TaskID -> ArduinoPrimitive (Maybe TaskStats)
+     QueryTaskStatsE      :: TaskIDE -> ArduinoPrimitive (Maybe TaskStats)
+     QueryOverruns        :: TaskID -> ArduinoPrimitive Word16
+     QueryOverrunsE       :: TaskIDE -> ArduinoPrimitive (Expr Word16)
+     TakeSemTimed         :: Word8 -> TimeMillis -> ArduinoPrimitive Bool
+     TakeSemTimedE        :: Expr Word8 -> TimeMillisE -> ArduinoPrimitive (Expr Bool)
+     QuerySem             :: Word8 -> ArduinoPrimitive (Maybe (Word16, Word8))
+     QuerySemE            :: Expr Word8 -> ArduinoPrimitive (Maybe (Word16, Word8))
+     QueueSend            :: QueueValue a => Word8 -> Bool -> a -> ArduinoPrimitive Bool
+     QueueSendE           :: QueueValue a => Expr Word8 -> Expr Bool -> Expr a -> ArduinoPrimitive (Expr Bool)
+     QueueReceive         :: QueueValue a => Word8 -> Bool -> a -> ArduinoPrimitive a
+     QueueReceiveE        :: QueueValue a => Expr Word8 -> Expr Bool -> Expr a -> ArduinoPrimitive (Expr a)
      BootTaskE            :: Expr [Word8] -> ArduinoPrimitive (Expr Bool)
      ReadRemoteRefB       :: RemoteRef Bool   -> ArduinoPrimitive Bool
      ReadRemoteRefBE      :: RemoteRef Bool   -> ArduinoPrimitive (Expr Bool)
@@ -536,10 +569,16 @@ instance KnownResult ArduinoPrimitive where
   knownResult (ServoWriteMicrosE {}    ) = Just LitUnit
   knownResult (CreateTask {}           ) = Just ()
   knownResult (CreateTaskE {}          ) = Just LitUnit
+  knownResult (SwapTask {}             ) = Just ()
+  knownResult (SwapTaskE {}            ) = Just LitUnit
   knownResult (DeleteTask {}           ) = Just ()
   knownResult (DeleteTaskE {}          ) = Just LitUnit
   knownResult (ScheduleTask  {}        ) = Just ()
   knownResult (ScheduleTaskE {}        ) = Just LitUnit
+  knownResult (SchedulePeriodic {}     ) = Just ()
+  knownResult (SchedulePeriodicE {}    ) = Just LitUnit
+  knownResult (TaskBudget {}           ) = Just ()
+  knownResult (TaskBudgetE {}          ) = Just LitUnit
   knownResult (ScheduleReset {}        ) = Just ()
   knownResult (ScheduleResetE {}       ) = Just LitUnit
   knownResult (AttachInt {}            ) = Just ()
@@ -553,6 +592,8 @@ instance KnownResult ArduinoPrimitive where
   knownResult (GiveSemE {}             ) = Just LitUnit
   knownResult (TakeSem {}              ) = Just ()
   knownResult (TakeSemE {}             ) = Just LitUnit
+  knownResult (CreateQueue {}          ) = Just ()
+  knownResult (CreateQueueE {}         ) = Just LitUnit
   knownResult (WriteRemoteRefBE {}     ) = Just LitUnit
   knownResult (WriteRemoteRefW8E {}    ) = Just LitUnit
   knownResult (WriteRemoteRefW16E {}   ) = Just LitUnit
@@ -685,6 +726,16 @@ createTask tid ps = Arduino $ primitive $ CreateTask tid ps
 createTaskE :: TaskIDE -> Arduino (Expr ()) -> Arduino (Expr ())
 createTaskE tid ps = Arduino $ primitive  $ CreateTaskE tid ps
 
+-- | Replace the code of an existing task without stopping it.  The new
+-- code is loaded alongside the old, and the task switches to it at the
+-- start of its first run after all of it has arrived.  The task's binds
+-- are kept if the flag is True, and cleared otherwise.
+swapTask :: TaskID -> Arduino () -> Bool -> Arduino ()
+swapTask tid ps k = Arduino $ primitive $ SwapTask tid ps k
+
+swapTaskE :: TaskIDE -> Arduino (Expr ()) -> Expr Bool -> Arduino (Expr ())
+swapTaskE tid ps k = Arduino $ primitive $ SwapTaskE tid ps k
+
 deleteTask :: TaskID -> Arduino ()
 deleteTask tid = Arduino $ primitive $ DeleteTask tid
 
@@ -697,6 +748,26 @@ scheduleTask tid tt = Arduino $ primitive $ ScheduleTask tid tt
 scheduleTaskE :: TaskIDE -> TimeMillisE -> Arduino (Expr ())
 scheduleTaskE tid tt = Arduino $ primitive $ ScheduleTaskE tid tt
 
+-- | Schedule a task to run first after the given number of milliseconds,
+-- and then every period microseconds.  Each release is timed from the
+-- previous one, so the period does not drift with the task's run time.
+schedulePeriodic :: TaskID -> TimeMillis -> TimeMicros -> Arduino ()
+schedulePeriodic tid tt p = Arduino $ primitive $ SchedulePeriodic tid tt p
+
+schedulePeriodicE :: TaskIDE -> TimeMillisE -> TimeMicrosE -> Arduino (Expr ())
+schedulePeriodicE tid tt p = Arduino $ primitive $ SchedulePeriodicE tid tt p
+
+-- | Limit how many microseconds a task may run before it yields to other
+-- tasks and to host commands, resuming where it left off.  The budget is
+-- checked between commands, and a budget of 0 removes the limit.  It is
+-- ignored by firmware built without INCLUDE_TASK_BUDGET, which is left
+-- out by default on boards with 4K of SRAM or less.
+taskBudget :: TaskID -> TimeMicros -> Arduino ()
+taskBudget tid b = Arduino $ primitive $ TaskBudget tid b
+
+taskBudgetE :: TaskIDE -> TimeMicrosE -> Arduino (Expr ())
+taskBudgetE tid b = Arduino $ primitive $ TaskBudgetE tid b
+
 attachInt :: Pin -> TaskID -> IntMode -> Arduino ()
 attachInt p tid m = Arduino $ primitive $ AttachInt p tid (fromIntegral $ fromEnum m)
 
@@ -739,6 +810,111 @@ takeSem i = Arduino $ primitive $ TakeSem i
 takeSemE :: Expr Word8 -> Arduino (Expr ())
 takeSemE i = Arduino $ primitive $ TakeSemE i
 
+-- | Take a semaphore, waiting no longer than the given number of
+-- milliseconds for it.  Returns False if the wait timed out.
+takeSemTimed :: Word8 -> TimeMillis -> Arduino Bool
+takeSemTimed i t = Arduino $ primitive $ TakeSemTimed i t
+
+takeSemTimedE :: Expr Word8 -> TimeMillisE -> Arduino (Expr Bool)
+takeSemTimedE i t = Arduino $ primitive $ TakeSemTimedE i t
+
+-- | The count of a semaphore, and the number of tasks waiting on it.
+querySem :: Word8 -> Arduino (Maybe (Word16, Word8))
+querySem i = Arduino $ primitive $ QuerySem i
+
+querySemE :: Expr Word8 -> Arduino (Maybe (Word16, Word8))
+querySemE i = Arduino $ primitive $ QuerySemE i
+
+-- | Types of the values which can be passed between tasks through a
+-- queue.  Each queued value keeps its type on the board, so a queue
+-- should only be used for one type.
+class (ExprB a, Show a) => QueueValue a where
+    queueEmpty :: a
+    queueValue :: [Word8] -> Maybe a
+
+instance QueueValue Bool where
+    queueEmpty = False
+    queueValue [_,_,b] = Just (if b == 0 then False else True)
+    queueValue _       = Nothing
+
+instance QueueValue Word8 where
+    queueEmpty = 0
+    queueValue [_,_,b] = Just b
+    queueValue _       = Nothing
+
+instance QueueValue Word16 where
+    queueEmpty = 0
+    queueValue [_,_,b1,b2] = Just $ bytesToWord16 (b1,b2)
+    queueValue _           = Nothing
+
+instance QueueValue Word32 where
+    queueEmpty = 0
+    queueValue [_,_,b1,b2,b3,b4] = Just $ bytesToWord32 (b1,b2,b3,b4)
+    queueValue _                 = Nothing
+
+instance QueueValue Int8 where
+    queueEmpty = 0
+    queueValue [_,_,b] = Just $ fromIntegral b
+    queueValue _       = Nothing
+
+instance QueueValue Int16 where
+    queueEmpty = 0
+    queueValue [_,_,b1,b2] = Just $ fromIntegral $ bytesToWord16 (b1,b2)
+    queueValue _           = Nothing
+
+instance QueueValue Int32 where
+    queueEmpty = 0
+    queueValue [_,_,b1,b2,b3,b4] = Just $ bytesToInt32 (b1,b2,b3,b4)
+    queueValue _                 = Nothing
+
+instance QueueValue Int where
+    queueEmpty = 0
+    queueValue [_,_,b1,b2,b3,b4] = Just $ fromIntegral $ bytesToInt32 (b1,b2,b3,b4)
+    queueValue _                 = Nothing
+
+instance QueueValue Float where
+    queueEmpty = 0
+    queueValue [_,_,b1,b2,b3,b4] = Just $ bytesToFloat (b1,b2,b3,b4)
+    queueValue _                 = Nothing
+
+-- | Create a queue holding up to the given number of values, replacing
+-- any queue with the same id which has no tasks waiting on it.
+createQueue :: Word8 -> Word8 -> Arduino ()
+createQueue q n = Arduino $ primitive $ CreateQueue q n
+
+createQueueE :: Expr Word8 -> Expr Word8 -> Arduino (Expr ())
+createQueueE q n = Arduino $ primitive $ CreateQueueE q n
+
+-- | Send a value to a queue.  In a task, this waits while the queue is
+-- full.  Returns False if the value could not be queued.
+sendQueue :: QueueValue a => Word8 -> a -> Arduino Bool
+sendQueue q v = Arduino $ primitive $ QueueSend q True v
+
+sendQueueE :: QueueValue a => Expr Word8 -> Expr a -> Arduino (Expr Bool)
+sendQueueE q v = Arduino $ primitive $ QueueSendE q (lit True) v
+
+-- | Send a value to a queue if it is not full.
+trySendQueue :: QueueValue a => Word8 -> a -> Arduino Bool
+trySendQueue q v = Arduino $ primitive $ QueueSend q False v
+
+trySendQueueE :: QueueValue a => Expr Word8 -> Expr a -> Arduino (Expr Bool)
+trySendQueueE q v = Arduino $ primitive $ QueueSendE q (lit False) v
+
+-- | Receive a value from a queue.  In a task, this waits while the queue
+-- is empty, and otherwise returns zero if there is nothing to receive.
+receiveQueue :: QueueValue a => Word8 -> Arduino a
+receiveQueue q = Arduino $ primitive $ QueueReceive q True queueEmpty
+
+receiveQueueE :: QueueValue a => Expr Word8 -> Arduino (Expr a)
+receiveQueueE q = Arduino $ primitive $ QueueReceiveE q (lit True) (lit queueEmpty)
+
+-- | Receive a value from a queue, or the given default if it is empty.
+tryReceiveQueue :: QueueValue a => Word8 -> a -> Arduino a
+tryReceiveQueue q d = Arduino $ primitive $ QueueReceive q False d
+
+tryReceiveQueueE :: QueueValue a => Expr Word8 -> Expr a -> Arduino (Expr a)
+tryReceiveQueueE q d = Arduino $ primitive $ QueueReceiveE q (lit False) d
+
 class ExprB a => RemoteReference a where
     newRemoteRef     :: a -> Arduino (RemoteRef a)
     newRemoteRefE    :: Expr a -> Arduino (RemoteRef a)
@@ -988,6 +1164,23 @@ queryTask tid = Arduino $ primitive $ QueryTask tid
 queryTaskE :: TaskIDE -> Arduino (Maybe (TaskLength, TaskLength, TaskPos, TimeMillis))
 queryTaskE tid = Arduino $ primitive $ QueryTaskE tid
 
+-- | Run statistics the firmware keeps for a task, or 'Nothing' if there
+-- is no such task or the firmware was built without INCLUDE_TASK_STATS,
+-- which is left out by default on boards with 4K of SRAM or less.
+queryTaskStats :: TaskID -> Arduino (Maybe TaskStats)
+queryTaskStats tid = Arduino $ primitive $ QueryTaskStats tid
+
+queryTaskStatsE :: TaskIDE -> Arduino (Maybe TaskStats)
+queryTaskStatsE tid = Arduino $ primitive $ QueryTaskStatsE tid
+
+-- | Number of release slots a periodic task has missed since it was
+-- scheduled.
+queryOverruns :: TaskID -> Arduino Word16
+queryOverruns tid = Arduino $ primitive $ QueryOverruns tid
+
+queryOverrunsE :: TaskIDE -> Arduino (Expr Word16)
+queryOverrunsE tid = Arduino $ primitive $ QueryOverrunsE tid
+
 bootTaskE :: Expr [Word8] -> Arduino (Expr Bool)
 bootTaskE tids = Arduino $ primitive $ BootTaskE tids
 
@@ -1577,7 +1770,12 @@ data Response = DelayResp
               | ServoReadReply Int16
               | ServoReadMicrosReply Int16
               | QueryAllTasksReply [Word8]           -- ^ Response to Query All Tasks
-              | QueryTaskReply (Maybe (TaskLength, TaskLength, TaskPos, TimeMillis))
+              | QueryTaskReply (Maybe (TaskLength, TaskLength, TaskPos, TimeMillis)) (Maybe TaskStats)
+              | QueryOverrunsReply Word16
+              | TakeSemReply Bool
+              | QuerySemReply (Maybe (Word16, Word8))
+              | QueueSendReply Bool
+              | QueueReceiveReply [Word8]
               | BootTaskResp Word8
               | NewReply Word8
               | ReadRefBReply Bool
@@ -1624,6 +1822,15 @@ data Response = DelayResp
               | Unimplemented (Maybe String) [Word8] -- ^ Represents messages currently unsupported
               | EmptyFrame
               | InvalidChecksumFrame [Word8]
+              | SeqAck Word8 Word8                   -- ^ Last sequenced frame executed, firmware window
+              | SeqNak Word8 Word8                   -- ^ As SeqAck, but later frames were lost
+              | StreamAck Word8 Word8                -- ^ Last stream frame written, firmware window
+              | StreamNak Word8 Word8                -- ^ As StreamAck, but later frames were lost
+              | StreamEndReply Bool                  -- ^ Streamed task passed its CRC check
+              | SetBaudReply Bool                    -- ^ Firmware agreed to change baud rate
+              | PinSamples Word32 [(Word8, Word16)]  -- ^ Sample time and (slot, value) pairs pushed by the board
+              | StatsReply (Maybe ProtocolStats)     -- ^ Protocol statistics, if the firmware keeps them
+              | ArenaReply (Maybe ArenaStats)        -- ^ Task arena usage
     deriving Show
 
 -- | Haskino Firmware commands, see:
@@ -1634,15 +1841,22 @@ data FirmwareCmd = BC_CMD_SYSTEM_RESET
                  | BC_CMD_DELAY_MICROS
                  | BC_CMD_ITERATE
                  | BC_CMD_IF_THEN_ELSE
+                 | BC_CMD_BATCH
+                 | BC_CMD_SET_BAUD
                  | BS_CMD_REQUEST_VERSION
                  | BS_CMD_REQUEST_TYPE
                  | BS_CMD_REQUEST_MICROS
                  | BS_CMD_REQUEST_MILLIS
                  | BS_CMD_DEBUG
+                 | BS_CMD_STATS
+                 | BS_CMD_ARENA_STATS
                  | DIG_CMD_READ_PIN
                  | DIG_CMD_WRITE_PIN
                  | DIG_CMD_READ_PORT
                  | DIG_CMD_WRITE_PORT
+                 | DIG_CMD_SUBSCRIBE
+                 | DIG_CMD_UNSUBSCRIBE
+                 | DIG_CMD_SAMPLING
                  | ALG_CMD_READ_PIN
                  | ALG_CMD_WRITE_PIN
                  | ALG_CMD_TONE_PIN
@@ -1681,6 +1895,16 @@ data FirmwareCmd = BC_CMD_SYSTEM_RESET
                  | SCHED_CMD_DETACH_INT
                  | SCHED_CMD_INTERRUPTS
                  | SCHED_CMD_NOINTERRUPTS
+                 | SCHED_CMD_PERIODIC
+                 | SCHED_CMD_OVERRUNS
+                 | SCHED_CMD_TAKE_SEM_TIMED
+                 | SCHED_CMD_QUERY_SEM
+                 | SCHED_CMD_QUEUE_CREATE
+                 | SCHED_CMD_QUEUE_SEND
+                 | SCHED_CMD_QUEUE_RECV
+                 | SCHED_CMD_STREAM_TASK
+                 | SCHED_CMD_TASK_BUDGET
+                 | SCHED_CMD_SWAP_TASK
                  | REF_CMD_NEW
                  | REF_CMD_READ
                  | REF_CMD_WRITE
@@ -1696,15 +1920,22 @@ firmwareCmdVal BC_CMD_DELAY_MILLIS      = 0x12
 firmwareCmdVal BC_CMD_DELAY_MICROS      = 0x13
 firmwareCmdVal BC_CMD_ITERATE           = 0x14
 firmwareCmdVal BC_CMD_IF_THEN_ELSE      = 0x15
+firmwareCmdVal BC_CMD_BATCH             = 0x16
+firmwareCmdVal BC_CMD_SET_BAUD          = 0x17
 firmwareCmdVal BS_CMD_REQUEST_VERSION   = 0x20
 firmwareCmdVal BS_CMD_REQUEST_TYPE      = 0x21
 firmwareCmdVal BS_CMD_REQUEST_MICROS    = 0x22
 firmwareCmdVal BS_CMD_REQUEST_MILLIS    = 0x23
 firmwareCmdVal BS_CMD_DEBUG             = 0x24
+firmwareCmdVal BS_CMD_STATS             = 0x25
+firmwareCmdVal BS_CMD_ARENA_STATS       = 0x26
 firmwareCmdVal DIG_CMD_READ_PIN         = 0x30
 firmwareCmdVal DIG_CMD_WRITE_PIN        = 0x31
 firmwareCmdVal DIG_CMD_READ_PORT        = 0x32
 firmwareCmdVal DIG_CMD_WRITE_PORT       = 0x33
+firmwareCmdVal DIG_CMD_SUBSCRIBE        = 0x34
+firmwareCmdVal DIG_CMD_UNSUBSCRIBE      = 0x35
+firmwareCmdVal DIG_CMD_SAMPLING         = 0x36
 firmwareCmdVal ALG_CMD_READ_PIN         = 0x40
 firmwareCmdVal ALG_CMD_WRITE_PIN        = 0x41
 firmwareCmdVal ALG_CMD_TONE_PIN         = 0x42
@@ -1736,6 +1967,16 @@ firmwareCmdVal SCHED_CMD_ATTACH_INT     = 0xAA
 firmwareCmdVal SCHED_CMD_DETACH_INT     = 0xAB
 firmwareCmdVal SCHED_CMD_INTERRUPTS     = 0xAC
 firmwareCmdVal SCHED_CMD_NOINTERRUPTS   = 0xAD
+firmwareCmdVal SCHED_CMD_PERIODIC       = 0xAE
+firmwareCmdVal SCHED_CMD_OVERRUNS       = 0xAF
+firmwareCmdVal SCHED_CMD_TAKE_SEM_TIMED = 0x70
+firmwareCmdVal SCHED_CMD_QUERY_SEM      = 0x71
+firmwareCmdVal SCHED_CMD_QUEUE_CREATE   = 0x72
+firmwareCmdVal SCHED_CMD_QUEUE_SEND     = 0x73
+firmwareCmdVal SCHED_CMD_QUEUE_RECV     = 0x74
+firmwareCmdVal SCHED_CMD_STREAM_TASK    = 0x75
+firmwareCmdVal SCHED_CMD_TASK_BUDGET    = 0x76
+firmwareCmdVal SCHED_CMD_SWAP_TASK      = 0x77
 firmwareCmdVal REF_CMD_NEW              = 0xC0
 firmwareCmdVal REF_CMD_READ             = 0xC1
 firmwareCmdVal REF_CMD_WRITE            = 0xC2
@@ -1756,15 +1997,22 @@ firmwareValCmd 0x12 = BC_CMD_DELAY_MILLIS
 firmwareValCmd 0x13 = BC_CMD_DELAY_MICROS
 firmwareValCmd 0x14 = BC_CMD_ITERATE
 firmwareValCmd 0x15 = BC_CMD_IF_THEN_ELSE
+firmwareValCmd 0x16 = BC_CMD_BATCH
+firmwareValCmd 0x17 = BC_CMD_SET_BAUD
 firmwareValCmd 0x20 = BS_CMD_REQUEST_VERSION
 firmwareValCmd 0x21 = BS_CMD_REQUEST_TYPE
 firmwareValCmd 0x22 = BS_CMD_REQUEST_MICROS
 firmwareValCmd 0x23 = BS_CMD_REQUEST_MILLIS
 firmwareValCmd 0x24 = BS_CMD_DEBUG
+firmwareValCmd 0x25 = BS_CMD_STATS
+firmwareValCmd 0x26 = BS_CMD_ARENA_STATS
 firmwareValCmd 0x30 = DIG_CMD_READ_PIN
 firmwareValCmd 0x31 = DIG_CMD_WRITE_PIN
 firmwareValCmd 0x32 = DIG_CMD_READ_PORT
 firmwareValCmd 0x33 = DIG_CMD_WRITE_PORT
+firmwareValCmd 0x34 = DIG_CMD_SUBSCRIBE
+firmwareValCmd 0x35 = DIG_CMD_UNSUBSCRIBE
+firmwareValCmd 0x36 = DIG_CMD_SAMPLING
 firmwareValCmd 0x40 = ALG_CMD_READ_PIN
 firmwareValCmd 0x41 = ALG_CMD_WRITE_PIN
 firmwareValCmd 0x42 = ALG_CMD_TONE_PIN
@@ -1796,6 +2044,16 @@ firmwareValCmd 0xAA = SCHED_CMD_ATTACH_INT
 firmwareValCmd 0xAB = SCHED_CMD_DETACH_INT
 firmwareValCmd 0xAC = SCHED_CMD_INTERRUPTS
 firmwareValCmd 0xAD = SCHED_CMD_NOINTERRUPTS
+firmwareValCmd 0xAE = SCHED_CMD_PERIODIC
+firmwareValCmd 0xAF = SCHED_CMD_OVERRUNS
+firmwareValCmd 0x70 = SCHED_CMD_TAKE_SEM_TIMED
+firmwareValCmd 0x71 = SCHED_CMD_QUERY_SEM
+firmwareValCmd 0x72 = SCHED_CMD_QUEUE_CREATE
+firmwareValCmd 0x73 = SCHED_CMD_QUEUE_SEND
+firmwareValCmd 0x74 = SCHED_CMD_QUEUE_RECV
+firmwareValCmd 0x75 = SCHED_CMD_STREAM_TASK
+firmwareValCmd 0x76 = SCHED_CMD_TASK_BUDGET
+firmwareValCmd 0x77 = SCHED_CMD_SWAP_TASK
 firmwareValCmd 0xC0 = REF_CMD_NEW
 firmwareValCmd 0xC1 = REF_CMD_READ
 firmwareValCmd 0xC2 = REF_CMD_WRITE
@@ -1814,14 +2072,19 @@ firmwareValCmd _    = UNKNOWN_COMMAND
 data FirmwareReply =  BC_RESP_DELAY
                    |  BC_RESP_IF_THEN_ELSE
                    |  BC_RESP_ITERATE
+                   |  BC_RESP_BATCH
+                   |  BC_RESP_SET_BAUD
                    |  BS_RESP_VERSION
                    |  BS_RESP_TYPE
                    |  BS_RESP_MICROS
                    |  BS_RESP_MILLIS
                    |  BS_RESP_STRING
                    |  BS_RESP_DEBUG
+                   |  BS_RESP_STATS
+                   |  BS_RESP_ARENA_STATS
                    |  DIG_RESP_READ_PIN
                    |  DIG_RESP_READ_PORT
+                   |  DIG_RESP_SAMPLES
                    |  ALG_RESP_READ_PIN
                    |  I2C_RESP_READ
                    |  SER_RESP_AVAIL
@@ -1836,40 +2099,65 @@ data FirmwareReply =  BC_RESP_DELAY
                    |  SCHED_RESP_QUERY
                    |  SCHED_RESP_QUERY_ALL
                    |  SCHED_RESP_BOOT
+                   |  SCHED_RESP_OVERRUNS
+                   |  SCHED_RESP_TAKE_SEM
+                   |  SCHED_RESP_QUERY_SEM
+                   |  SCHED_RESP_QUEUE_SEND
+                   |  SCHED_RESP_QUEUE_RECV
                    |  REF_RESP_NEW
                    |  REF_RESP_READ
                    |  EXPR_RESP_RET
+                   |  SEQ_RESP_ACK
+                   |  SEQ_RESP_NAK
+                   |  STREAM_RESP_ACK
+                   |  STREAM_RESP_NAK
+                   |  STREAM_RESP_END
                 deriving Show
 
 getFirmwareReply :: Word8 -> Either Word8 FirmwareReply
 getFirmwareReply 0x18 = Right BC_RESP_DELAY
 getFirmwareReply 0x19 = Right BC_RESP_IF_THEN_ELSE
 getFirmwareReply 0x1A = Right BC_RESP_ITERATE
+getFirmwareReply 0x1B = Right BC_RESP_BATCH
+getFirmwareReply 0x1C = Right BC_RESP_SET_BAUD
 getFirmwareReply 0x28 = Right BS_RESP_VERSION
 getFirmwareReply 0x29 = Right BS_RESP_TYPE
 getFirmwareReply 0x2A = Right BS_RESP_MICROS
 getFirmwareReply 0x2B = Right BS_RESP_MILLIS
 getFirmwareReply 0x2C = Right BS_RESP_STRING
 getFirmwareReply 0x2D = Right BS_RESP_DEBUG
+getFirmwareReply 0x2E = Right BS_RESP_STATS
+getFirmwareReply 0x2F = Right BS_RESP_ARENA_STATS
 getFirmwareReply 0x38 = Right DIG_RESP_READ_PIN
 getFirmwareReply 0x39 = Right DIG_RESP_READ_PORT
+getFirmwareReply 0x3A = Right DIG_RESP_SAMPLES
 getFirmwareReply 0x48 = Right ALG_RESP_READ_PIN
 getFirmwareReply 0x58 = Right I2C_RESP_READ
 getFirmwareReply 0x68 = Right STEP_RESP_2PIN
 getFirmwareReply 0x69 = Right STEP_RESP_4PIN
 getFirmwareReply 0x6A = Right STEP_RESP_STEP
+getFirmwareReply 0x78 = Right SCHED_RESP_TAKE_SEM
+getFirmwareReply 0x79 = Right SCHED_RESP_QUERY_SEM
+getFirmwareReply 0x7A = Right SCHED_RESP_QUEUE_SEND
+getFirmwareReply 0x7B = Right SCHED_RESP_QUEUE_RECV
 getFirmwareReply 0x88 = Right SRVO_RESP_ATTACH
 getFirmwareReply 0x89 = Right SRVO_RESP_READ
 getFirmwareReply 0x8A = Right SRVO_RESP_READ_MICROS
 getFirmwareReply 0xB0 = Right SCHED_RESP_QUERY
 getFirmwareReply 0xB1 = Right SCHED_RESP_QUERY_ALL
 getFirmwareReply 0xB2 = Right SCHED_RESP_BOOT
+getFirmwareReply 0xB3 = Right SCHED_RESP_OVERRUNS
 getFirmwareReply 0xC8 = Right REF_RESP_NEW
 getFirmwareReply 0xC9 = Right REF_RESP_READ
 getFirmwareReply 0xD8 = Right EXPR_RESP_RET
 getFirmwareReply 0xE8 = Right SER_RESP_AVAIL
 getFirmwareReply 0xE9 = Right SER_RESP_READ
 getFirmwareReply 0xEA = Right SER_RESP_READ_LIST
+getFirmwareReply 0xF8 = Right SEQ_RESP_ACK
+getFirmwareReply 0xF9 = Right SEQ_RESP_NAK
+getFirmwareReply 0xFA = Right STREAM_RESP_ACK
+getFirmwareReply 0xFB = Right STREAM_RESP_NAK
+getFirmwareReply 0xFC = Right STREAM_RESP_END
 getFirmwareReply n    = Left n
 
 data Processor = ATMEGA8
@@ -1886,3 +2174,68 @@ data Processor = ATMEGA8
                | QUARK
                | UNKNOWN_PROCESSOR
     deriving (Eq, Show, Enum)
+
+-- | Baud rates which may be negotiated with the firmware, in the order
+-- of the firmware rate codes.  The host port can only be switched to
+-- the rates above 115200 outside of the serialport package, see
+-- 'System.Hardware.Haskino.Comm.negotiateBaud'.
+data BaudRate = Baud115200
+              | Baud500000
+              | Baud1000000
+              | Baud2000000
+    deriving (Eq, Show, Enum)
+
+-- | Firmware protocol counters, and for each command type (indexed by
+-- the upper nibble of the command) a histogram of command execution
+-- times.  Bin n counts times under 2^(6+n) microseconds, and the last
+-- bin counts all longer times.
+data ProtocolStats = ProtocolStats {
+                statFramesReceived :: Word32
+              , statChecksumErrors :: Word32
+              , statEscapeBytes    :: Word32
+              , statOverruns       :: Word32
+              , statBytesSent      :: Word32
+              , statLatency        :: [[Word16]]
+              }
+    deriving (Eq, Show)
+
+-- | Firmware run statistics for a task.  'taskCpuMicros' is the total
+-- time the task has run, and 'taskMaxRunMicros' its longest single run
+-- before finishing or yielding.  'taskStartLatency' is a histogram of the
+-- time from when the task was due to when it started, with the bins of
+-- the 'ProtocolStats' latency histograms.
+data TaskStats = TaskStats {
+                taskActivations  :: Word32
+              , taskCpuMicros    :: Word32
+              , taskMaxRunMicros :: Word32
+              , taskStartLatency :: [Word16]
+              }
+    deriving (Eq, Show)
+
+-- | Usage of the firmware task arena, in bytes.  'arenaLargest' is the
+-- largest task block which can currently be created in it.  Tasks which
+-- do not fit the arena are allocated from the firmware heap, and
+-- 'arenaFailures' counts task creations refused for lack of room in both.
+data ArenaStats = ArenaStats {
+                arenaSize     :: Word16
+              , arenaFree     :: Word16
+              , arenaLargest  :: Word16
+              , arenaFailures :: Word16
+              }
+    deriving (Eq, Show)
+
+-- | Whether a subscribed pin is sampled with digitalRead or analogRead.
+data SampleType = DigitalSample
+                | AnalogSample
+    deriving (Eq, Show, Enum)
+
+-- | A pin sampling subscription.  The pin is sampled every
+-- 'subPeriod' milliseconds, and the rounded mean of every
+-- 'subDecimation' samples is pushed to the host.
+data Subscription = Subscription {
+                subPin        :: Word8
+              , subType       :: SampleType
+              , subPeriod     :: Word16
+              , subDecimation :: Word8
+              }
+    deriving (Eq, Show)
@@ -129,15 +129,22 @@ decodeCmdArgs BC_CMD_IF_THEN_ELSE _ (rt1 :< rt2 :< b :< xs) = (cmd ++ dec ++ "\n
     dec' = decodeCodeBlock (B.take (fromIntegral thenSize) xs') "Then"
     dec'' = decodeCodeBlock (B.drop (fromIntegral thenSize) xs') "Else"
 decodeCmdArgs BC_CMD_IF_THEN_ELSE _ bs = decodeErr bs
+decodeCmdArgs BC_CMD_BATCH _ xs = ("\n" ++ decodeCodeBlock xs "Batch", B.empty)
+decodeCmdArgs BC_CMD_SET_BAUD _ xs = decodeExprProc 1 xs
 decodeCmdArgs BS_CMD_REQUEST_VERSION _ xs = decodeExprProc 0 xs
 decodeCmdArgs BS_CMD_REQUEST_TYPE _ xs = decodeExprProc 0 xs
 decodeCmdArgs BS_CMD_REQUEST_MICROS _ xs = decodeExprProc 0 xs
 decodeCmdArgs BS_CMD_REQUEST_MILLIS _ xs = decodeExprProc 0 xs
 decodeCmdArgs BS_CMD_DEBUG _ xs = decodeExprProc 1 xs
+decodeCmdArgs BS_CMD_STATS _ xs = decodeExprProc 1 xs
+decodeCmdArgs BS_CMD_ARENA_STATS _ xs = decodeExprProc 0 xs
 decodeCmdArgs DIG_CMD_READ_PIN _ xs = decodeExprProc 1 xs
 decodeCmdArgs DIG_CMD_WRITE_PIN _ xs = decodeExprCmd 2 xs
 decodeCmdArgs DIG_CMD_READ_PORT _ xs = decodeExprProc 2 xs
 decodeCmdArgs DIG_CMD_WRITE_PORT _ xs = decodeExprCmd 3 xs
+decodeCmdArgs DIG_CMD_SUBSCRIBE _ xs = decodeExprCmd 5 xs
+decodeCmdArgs DIG_CMD_UNSUBSCRIBE _ xs = decodeExprCmd 1 xs
+decodeCmdArgs DIG_CMD_SAMPLING _ xs = decodeExprCmd 2 xs
 decodeCmdArgs ALG_CMD_READ_PIN _ xs = decodeExprProc 1 xs
 decodeCmdArgs ALG_CMD_WRITE_PIN _ xs = decodeExprCmd 2 xs
 decodeCmdArgs ALG_CMD_TONE_PIN _ xs = decodeExprCmd 3 xs
@@ -179,6 +186,16 @@ decodeCmdArgs SCHED_CMD_GIVE_SEM _ xs = decodeExprCmd 1 xs
 decodeCmdArgs SCHED_CMD_TAKE_SEM _ xs = decodeExprCmd 1 xs
 decodeCmdArgs SCHED_CMD_INTERRUPTS _ xs = decodeExprCmd 0 xs
 decodeCmdArgs SCHED_CMD_NOINTERRUPTS _ xs = decodeExprCmd 0 xs
+decodeCmdArgs SCHED_CMD_PERIODIC _ xs = decodeExprCmd 3 xs
+decodeCmdArgs SCHED_CMD_OVERRUNS _ xs = decodeExprProc 1 xs
+decodeCmdArgs SCHED_CMD_TAKE_SEM_TIMED _ xs = decodeExprProc 2 xs
+decodeCmdArgs SCHED_CMD_QUERY_SEM _ xs = decodeExprProc 1 xs
+decodeCmdArgs SCHED_CMD_QUEUE_CREATE _ xs = decodeExprCmd 2 xs
+decodeCmdArgs SCHED_CMD_QUEUE_SEND _ xs = decodeExprProc 3 xs
+decodeCmdArgs SCHED_CMD_QUEUE_RECV _ xs = decodeExprProc 3 xs
+decodeCmdArgs SCHED_CMD_STREAM_TASK _ xs = decodeExprCmd 3 xs
+decodeCmdArgs SCHED_CMD_TASK_BUDGET _ xs = decodeExprCmd 2 xs
+decodeCmdArgs SCHED_CMD_SWAP_TASK _ xs = decodeExprCmd 4 xs
 decodeCmdArgs REF_CMD_NEW _ xs = decodeRefNew 1 xs
 decodeCmdArgs REF_CMD_READ _ xs =  decodeRefProc 1 xs
 decodeCmdArgs REF_CMD_WRITE _ xs = decodeRefCmd 2 xs
@@ -260,18 +277,34 @@ decodeExpr (ty :< op :< bs) = (" (" ++ opStr ++ ")", bs')
 decodeExpr _                = decodeErr B.empty
 
 decodeTypeOp :: ExprType -> Int -> B.ByteString -> (String, B.ByteString)
-decodeTypeOp etype op bs =
-  case etype of
-    EXPR_LIST8 -> (show etype ++ "-" ++ show elop ++ delop, bs'')
-    EXPR_FLOAT -> (show etype ++ "-" ++ show efop ++ defop, bs''')
-    _          -> (show etype ++ "-" ++ show eop  ++ deop,  bs')
+decodeTypeOp etype op bs
+  | etype /= EXPR_LIST8 && (op .&. 0xE0) == fromIntegral exprImm =
+      (show etype ++ "-EXPR_IMM " ++ decodeCompactLit etype imm, bs)
+  | etype /= EXPR_LIST8 && op == fromIntegral exprVLit =
+      (show etype ++ "-EXPR_VLIT " ++ decodeCompactLit etype v, B.pack vbs)
+  | otherwise =
+    case etype of
+      EXPR_LIST8 -> (show etype ++ "-" ++ show elop ++ delop, bs'')
+      EXPR_FLOAT -> (show etype ++ "-" ++ show efop ++ defop, bs''')
+      _          -> (show etype ++ "-" ++ show eop  ++ deop,  bs')
   where
     eop  = toEnum op::ExprOp
     elop = toEnum op::ExprListOp
     efop = toEnum op::ExprFloatOp
+    imm  = fromIntegral op .&. fromIntegral exprImmMask
     (deop, bs')    = decodeOp etype eop bs
     (delop, bs'')  = decodeListOp elop bs
     (defop, bs''') = decodeFloatOp efop bs
+    (v, vbs)       = bytesToVarint $ B.unpack bs
+
+decodeCompactLit :: ExprType -> Word32 -> String
+decodeCompactLit etype v =
+  case etype of
+    EXPR_INT8  -> show ((fromIntegral $ unZigZag32 v)::Int8)
+    EXPR_INT16 -> show ((fromIntegral $ unZigZag32 v)::Int16)
+    EXPR_INT32 -> show (unZigZag32 v)
+    EXPR_FLOAT -> show ((fromIntegral $ unZigZag32 v)::Float)
+    _          -> show v
 
 decodeOp :: ExprType -> ExprOp -> B.ByteString -> (String, B.ByteString)
 decodeOp etype eop bs =
@@ -1223,6 +1223,18 @@ data ExprFloatOp = EXPRF_LIT
             | EXPRF_ISINF
           deriving (Show, Enum, Ord, Eq)
 
+-- Compact literal ops live outside the ExprOp enumeration.  EXPR_IMM
+-- carries values up to exprImmMask in the op byte, EXPR_VLIT is followed
+-- by a varint.  Signed and Float values are zigzag encoded.
+exprVLit :: Word8
+exprVLit = 0x30
+
+exprImm :: Word8
+exprImm = 0xC0
+
+exprImmMask :: Word8
+exprImmMask = 0x1F
+
 exprCmdVal :: ExprType -> ExprOp -> [Word8]
 exprCmdVal t o = [toW8 t, toW8 o]
 
@@ -13,10 +13,12 @@
 {-# LANGUAGE GADTs               #-}
 {-# LANGUAGE ScopedTypeVariables #-}
 
-module System.Hardware.Haskino.Protocol(framePackage, packageCommand,
+module System.Hardware.Haskino.Protocol(framePackage, batchPackage, seqFramePackage, packageCommand,
+                                            streamFramePackage, crc16,
                                             packageProcedure, packageRemoteBinding,
                                             unpackageResponse, parseQueryResult,
                                             maxFirmwareSize, packageExpr,
+                                            packageCodeBlock,
                                             CommandState(..) ) where
 
 import           Control.Monad.State
@@ -25,15 +27,17 @@ import           Control.Remote.Monad
 import           Control.Remote.Monad.Types       as T
 import           Data.Bits
 import qualified Data.ByteString                  as B
-import           Data.Int                         (Int16)
-import           Data.Word                        (Word8)
+import           Data.Int                         (Int16, Int32)
+import           Data.Word                        (Word8, Word16, Word32)
 import           System.Hardware.Haskino.Data
 import           System.Hardware.Haskino.Expr
 import           System.Hardware.Haskino.Utils
 
--- | Maximum size of a Haskino Firmware message
+-- | Maximum size of a Haskino Firmware message.  The largest frame, with
+-- a sequence header, its CRC and the firmware's two byte length header,
+-- fits the 256 byte receive buffer of boards with little SRAM.
 maxFirmwareSize :: Int
-maxFirmwareSize = 256
+maxFirmwareSize = 252
 
 -- | Minimum and maximum servo pulse widths
 minServo :: Int16
@@ -53,12 +57,69 @@ data CommandState = CommandState {ix        :: Int
 framePackage :: B.ByteString -> B.ByteString
 framePackage bs = B.append (B.concatMap escape bs) (B.append (escape $ check bs) (B.singleton 0x7E))
   where
-    escape :: Word8 -> B.ByteString
-    escape c = if c == 0x7E || c == 0x7D
-               then B.pack $ [0x7D, xor c 0x20]
-               else B.singleton c
     check b = B.foldl (+) 0 b
 
+escape :: Word8 -> B.ByteString
+escape c = if c == 0x7E || c == 0x7D
+           then B.pack $ [0x7D, xor c 0x20]
+           else B.singleton c
+
+-- | Frame a command as a sequenced frame.  The SEQ_FRAME header and the
+-- sequence number precede the command, and a CRC-16 (high byte first)
+-- replaces the checksum.
+seqFramePackage :: Word8 -> B.ByteString -> B.ByteString
+seqFramePackage s bs = B.append (B.concatMap escape body) (B.singleton 0x7E)
+  where
+    hdr  = B.append (B.pack [0xF0, s]) bs
+    crc  = crc16 hdr
+    body = B.append hdr (B.pack [fromIntegral (crc `shiftR` 8), fromIntegral crc])
+
+-- | Frame part of the code of a task being streamed.  Stream frames are
+-- laid out as sequenced frames, with the STREAM_FRAME header, and are
+-- written straight into the task by the firmware.
+streamFramePackage :: Word8 -> B.ByteString -> B.ByteString
+streamFramePackage s bs = B.append (B.concatMap escape body) (B.singleton 0x7E)
+  where
+    hdr  = B.append (B.pack [0xF1, s]) bs
+    crc  = crc16 hdr
+    body = B.append hdr (B.pack [fromIntegral (crc `shiftR` 8), fromIntegral crc])
+
+-- | CRC-16/CCITT (polynomial 0x1021, initial value 0xFFFF), as computed
+-- by the firmware from its lookup table.
+crc16 :: B.ByteString -> Word16
+crc16 = B.foldl' crcByte 0xFFFF
+  where
+    crcByte crc b = iterate crcBit (crc `xor` (fromIntegral b `shiftL` 8)) !! 8
+    crcBit c = if testBit c 15
+               then (c `shiftL` 1) `xor` 0x1021
+               else c `shiftL` 1
+
+-- | Frame a sequence of commands using as few frames as possible.  Commands
+-- are combined into BC_CMD_BATCH frames, with each command preceded by its
+-- length encoded as in a code block, up to the maximum frame size.  A
+-- command that can not share a frame is framed on its own.
+batchPackage :: [B.ByteString] -> B.ByteString
+batchPackage []   = B.empty
+batchPackage cmds = B.append (frameBatch batch) (batchPackage rest)
+  where
+    (batch, rest) = splitBatch 1 cmds
+
+    -- Max batch size is max frame size - 2
+    -- checksum - 1 byte, frame flag - 1 byte
+    maxBatchSize = maxFirmwareSize - 2
+
+    splitBatch :: Int -> [B.ByteString] -> ([B.ByteString], [B.ByteString])
+    splitBatch _ [] = ([], [])
+    splitBatch n (c:cs) | n == 1 || n' <= maxBatchSize = (c : bs, rs)
+                        | otherwise                    = ([], c : cs)
+      where
+        n' = n + B.length (lenPackage c)
+        (bs, rs) = splitBatch n' cs
+
+    frameBatch :: [B.ByteString] -> B.ByteString
+    frameBatch [c] = framePackage c
+    frameBatch cs  = framePackage $ B.concat $ buildCommand BC_CMD_BATCH [] : map lenPackage cs
+
 addCommand :: FirmwareCmd -> [Word8] -> State CommandState B.ByteString
 addCommand cmd bs = return $ buildCommand cmd bs
 
@@ -70,6 +131,21 @@ packageUnsupported s = do
   _ <- error $ "Error: Cannot package Shallow Task command, use deep version:" ++ s
   return B.empty
 
+-- | Frame the code of a task as SCHED_CMD_ADD_TO_TASK commands
+addToTaskCmds :: TaskIDE -> B.ByteString -> B.ByteString
+addToTaskCmds tid tds | fromIntegral (B.length tds) > maxCmdSize =
+    addToTask (B.take maxCmdSize tds)
+        `B.append` (addToTaskCmds tid (B.drop maxCmdSize tds))
+                      | otherwise = addToTask tds
+  where
+    -- Max command data size is max frame size - 7
+    -- command - 1 byte,checksum - 1 byte,frame flag - 1 byte
+    -- task ID - 2 bytes (lit + constant), size - 2 bytes (lit + constant)
+    maxCmdSize = maxFirmwareSize - 7
+    addToTask tds' = framePackage $ buildCommand SCHED_CMD_ADD_TO_TASK ((packageExpr tid) ++
+                                                                          (packageExpr (LitW8 (fromIntegral (B.length tds')))) ++
+                                                                          (B.unpack tds'))
+
 -- | Package a request as a sequence of bytes to be sent to the board
 -- using the Haskino Firmware protocol.
 packageCommand :: forall a . ArduinoPrimitive a -> State CommandState B.ByteString
@@ -115,6 +191,12 @@ packageCommand (DeleteTaskE tid) =
 packageCommand (ScheduleTask tid tt) = packageUnsupported $ "scheduleTask " ++ show tid ++ " " ++ show tt
 packageCommand (ScheduleTaskE tid tt) =
     addCommand SCHED_CMD_SCHED_TASK (packageExpr tid ++ packageExpr tt)
+packageCommand (SchedulePeriodic tid tt p) = packageUnsupported $ "schedulePeriodic " ++ show tid ++ " " ++ show tt ++ " " ++ show p
+packageCommand (SchedulePeriodicE tid tt p) =
+    addCommand SCHED_CMD_PERIODIC (packageExpr tid ++ packageExpr tt ++ packageExpr p)
+packageCommand (TaskBudget tid b) = packageUnsupported $ "taskBudget " ++ show tid ++ " " ++ show b
+packageCommand (TaskBudgetE tid b) =
+    addCommand SCHED_CMD_TASK_BUDGET (packageExpr tid ++ packageExpr b)
 packageCommand ScheduleReset = packageUnsupported $ "scheduleReset"
 packageCommand ScheduleResetE =
     addCommand SCHED_CMD_RESET []
@@ -136,25 +218,23 @@ packageCommand (GiveSemE i) =
 packageCommand (TakeSem i) = packageUnsupported $ "takeSem " ++ show i
 packageCommand (TakeSemE i) =
     addCommand SCHED_CMD_TAKE_SEM (packageExpr i)
+packageCommand (CreateQueue q n) = packageUnsupported $ "createQueue " ++ show q ++ " " ++ show n
+packageCommand (CreateQueueE q n) =
+    addCommand SCHED_CMD_QUEUE_CREATE (packageExpr q ++ packageExpr n)
 packageCommand (CreateTask tid _) = packageUnsupported $ "createTask " ++ show tid
 packageCommand (CreateTaskE tid m) = do
     (_, td, _) <- packageCodeBlock m
     s <- get
     let taskSize = fromIntegral (B.length td)
     cmd <- addCommand SCHED_CMD_CREATE_TASK ((packageExpr tid) ++ (packageExpr (LitW16 taskSize)) ++ (packageExpr (LitW16 (fromIntegral (ib s)))))
-    return $ (framePackage cmd) `B.append` (genAddToTaskCmds td)
-  where
-    -- Max command data size is max frame size - 7
-    -- command - 1 byte,checksum - 1 byte,frame flag - 1 byte
-    -- task ID - 2 bytes (lit + constant), size - 2 bytes (lit + constant)
-    maxCmdSize = maxFirmwareSize - 7
-    genAddToTaskCmds tds | fromIntegral (B.length tds) > maxCmdSize =
-        addToTask (B.take maxCmdSize tds)
-            `B.append` (genAddToTaskCmds (B.drop maxCmdSize tds))
-    genAddToTaskCmds tds = addToTask tds
-    addToTask tds' = framePackage $ buildCommand SCHED_CMD_ADD_TO_TASK ((packageExpr tid) ++
-                                                                          (packageExpr (LitW8 (fromIntegral (B.length tds')))) ++
-                                                                          (B.unpack tds'))
+    return $ (framePackage cmd) `B.append` (addToTaskCmds tid td)
+packageCommand (SwapTask tid _ _) = packageUnsupported $ "swapTask " ++ show tid
+packageCommand (SwapTaskE tid m k) = do
+    (_, td, _) <- packageCodeBlock m
+    s <- get
+    let taskSize = fromIntegral (B.length td)
+    cmd <- addCommand SCHED_CMD_SWAP_TASK ((packageExpr tid) ++ (packageExpr (LitW16 taskSize)) ++ (packageExpr (LitW16 (fromIntegral (ib s)))) ++ (packageExpr k))
+    return $ (framePackage cmd) `B.append` (addToTaskCmds tid td)
 packageCommand (WriteRemoteRefBE (RemoteRefB i) e) = addWriteRefCommand EXPR_BOOL i e
 packageCommand (WriteRemoteRefW8E (RemoteRefW8 i) e) = addWriteRefCommand EXPR_WORD8 i e
 packageCommand (WriteRemoteRefW16E (RemoteRefW16 i) e) = addWriteRefCommand EXPR_WORD16 i e
@@ -323,6 +403,26 @@ packageCodeBlock (Arduino commands) = do
           return $ RemBindList8 i
       packProcedure (QueryTask t) = packShallowProcedure (QueryTask t) Nothing
       packProcedure (QueryTaskE t) = packShallowProcedure (QueryTaskE t) Nothing
+      packProcedure (QueryTaskStats t) = packShallowProcedure (QueryTaskStats t) Nothing
+      packProcedure (QueryTaskStatsE t) = packShallowProcedure (QueryTaskStatsE t) Nothing
+      packProcedure (QueryOverruns t) = packShallowProcedure (QueryOverruns t) 0
+      packProcedure (QueryOverrunsE t) = do
+          i <- packDeepProcedure (QueryOverrunsE t)
+          return $ RemBindW16 i
+      packProcedure (TakeSemTimed s t) = packShallowProcedure (TakeSemTimed s t) False
+      packProcedure (TakeSemTimedE s t) = do
+          i <- packDeepProcedure (TakeSemTimedE s t)
+          return $ RemBindB i
+      packProcedure (QuerySem s) = packShallowProcedure (QuerySem s) Nothing
+      packProcedure (QuerySemE s) = packShallowProcedure (QuerySemE s) Nothing
+      packProcedure (QueueSend q b v) = packShallowProcedure (QueueSend q b v) False
+      packProcedure (QueueSendE q b v) = do
+          i <- packDeepProcedure (QueueSendE q b v)
+          return $ RemBindB i
+      packProcedure (QueueReceive q b d) = packShallowProcedure (QueueReceive q b d) d
+      packProcedure (QueueReceiveE q b d) = do
+          i <- packDeepProcedure (QueueReceiveE q b d)
+          return $ remBind i
       packProcedure (BootTaskE tids) = do
           i <- packDeepProcedure (BootTaskE tids)
           return $ RemBindB i
@@ -1249,6 +1349,18 @@ packageProcedure p = do
     packageProcedure' QueryAllTasksE ib'   = addCommand SCHED_CMD_QUERY_ALL [fromIntegral ib']
     packageProcedure' (QueryTask tid) ib'  = addCommand SCHED_CMD_QUERY ((fromIntegral ib') : (packageExpr $ lit tid))
     packageProcedure' (QueryTaskE tide) ib' = addCommand SCHED_CMD_QUERY ((fromIntegral ib') : (packageExpr tide))
+    packageProcedure' (QueryTaskStats tid) ib'  = addCommand SCHED_CMD_QUERY ((fromIntegral ib') : (packageExpr $ lit tid))
+    packageProcedure' (QueryTaskStatsE tide) ib' = addCommand SCHED_CMD_QUERY ((fromIntegral ib') : (packageExpr tide))
+    packageProcedure' (QueryOverruns tid) ib'  = addCommand SCHED_CMD_OVERRUNS ((fromIntegral ib') : (packageExpr $ lit tid))
+    packageProcedure' (QueryOverrunsE tide) ib' = addCommand SCHED_CMD_OVERRUNS ((fromIntegral ib') : (packageExpr tide))
+    packageProcedure' (TakeSemTimed s t) ib' = addCommand SCHED_CMD_TAKE_SEM_TIMED ((fromIntegral ib') : (packageExpr (lit s) ++ packageExpr (lit t)))
+    packageProcedure' (TakeSemTimedE s t) ib' = addCommand SCHED_CMD_TAKE_SEM_TIMED ((fromIntegral ib') : (packageExpr s ++ packageExpr t))
+    packageProcedure' (QuerySem s) ib'  = addCommand SCHED_CMD_QUERY_SEM ((fromIntegral ib') : (packageExpr $ lit s))
+    packageProcedure' (QuerySemE s) ib' = addCommand SCHED_CMD_QUERY_SEM ((fromIntegral ib') : (packageExpr s))
+    packageProcedure' (QueueSend q b v) ib' = addCommand SCHED_CMD_QUEUE_SEND ((fromIntegral ib') : (packageExpr (lit q) ++ packageExpr (lit b) ++ packageExpr (lit v)))
+    packageProcedure' (QueueSendE q b v) ib' = addCommand SCHED_CMD_QUEUE_SEND ((fromIntegral ib') : (packageExpr q ++ packageExpr b ++ packageExpr v))
+    packageProcedure' (QueueReceive q b d) ib' = addCommand SCHED_CMD_QUEUE_RECV ((fromIntegral ib') : (packageExpr (lit q) ++ packageExpr (lit b) ++ packageExpr (lit d)))
+    packageProcedure' (QueueReceiveE q b d) ib' = addCommand SCHED_CMD_QUEUE_RECV ((fromIntegral ib') : (packageExpr q ++ packageExpr b ++ packageExpr d))
     packageProcedure' (DelayMillis ms) ib'  = addCommand BC_CMD_DELAY_MILLIS ((fromIntegral ib') : (packageExpr $ lit ms))
     packageProcedure' (DelayMillisE ms) ib' = addCommand BC_CMD_DELAY_MILLIS ((fromIntegral ib') : (packageExpr ms))
     packageProcedure' (DelayMicros ms) ib'  = addCommand BC_CMD_DELAY_MICROS ((fromIntegral ib') : (packageExpr $ lit ms))
@@ -1623,6 +1735,17 @@ packageExprEither :: (ExprB a, ExprB b) => ExprType -> ExprType -> ExprEither a
 packageExprEither t1  _t2 (ExprLeft i el) = [toW8 t1, toW8 EXPR_LEFT] ++ packageExpr el
 packageExprEither _t1 _t2 (ExprRight er) = packageExpr er
 
+-- Package a literal in the shortest form the firmware evaluators accept:
+-- an immediate in the op byte, a varint, or the full width value bytes.
+-- Signed values are passed in already zigzag encoded.
+packageLit :: ExprType -> Word32 -> [Word8] -> [Word8]
+packageLit t v ws
+  | v <= fromIntegral exprImmMask  = [toW8 t, exprImm .|. fromIntegral v]
+  | length vs < length ws          = [toW8 t, exprVLit] ++ vs
+  | otherwise                      = [toW8 t, toW8 EXPR_LIT] ++ ws
+  where
+    vs = varintToBytes v
+
 packageExpr :: Expr a -> [Word8]
 packageExpr (LitUnit) = [toW8 EXPR_UNIT, toW8 EXPR_LIT]
 packageExpr (ShowUnit e) = packageSubExpr (exprCmdVal EXPR_UNIT EXPR_SHOW) e
@@ -1663,7 +1786,7 @@ packageExpr (EqPinMode e1 e2) = packageTwoSubExpr (exprCmdVal EXPR_WORD8 EXPR_EQ
 packageExpr (ShowPinMode e) = packageSubExpr (exprCmdVal EXPR_WORD8 EXPR_SHOW) e
 packageExpr (IfPinMode e1 e2 e3) = packageIfBSubExpr (exprCmdVal EXPR_WORD8 EXPR_IF) e1 e2 e3
 packageExpr (RemBindPinMode b) = (exprCmdVal EXPR_WORD8 EXPR_BIND) ++ [fromIntegral b]
-packageExpr (LitW8 w) = (exprCmdVal EXPR_WORD8 EXPR_LIT) ++ [w]
+packageExpr (LitW8 w) = packageLit EXPR_WORD8 (fromIntegral w) [w]
 packageExpr (ShowW8 e) = packageSubExpr (exprCmdVal EXPR_WORD8 EXPR_SHOW) e
 packageExpr (RefW8 n) = packageRef n (exprCmdVal EXPR_WORD8 EXPR_REF)
 packageExpr (RemBindW8 b) = (exprCmdVal EXPR_WORD8 EXPR_BIND) ++ [fromIntegral b]
@@ -1688,7 +1811,7 @@ packageExpr (IfW8 e1 e2 e3) = packageIfBSubExpr (exprCmdVal EXPR_WORD8 EXPR_IF)
 packageExpr (TestBW8 e1 e2) = packageTwoSubExpr (exprCmdVal EXPR_WORD8 EXPR_TSTB) e1 e2
 packageExpr (SetBW8 e1 e2) = packageTwoSubExpr (exprCmdVal EXPR_WORD8 EXPR_SETB) e1 e2
 packageExpr (ClrBW8 e1 e2) = packageTwoSubExpr (exprCmdVal EXPR_WORD8 EXPR_CLRB) e1 e2
-packageExpr (LitW16 w) = (exprCmdVal EXPR_WORD16 EXPR_LIT) ++ word16ToBytes w
+packageExpr (LitW16 w) = packageLit EXPR_WORD16 (fromIntegral w) (word16ToBytes w)
 packageExpr (ShowW16 e) = packageSubExpr (exprCmdVal EXPR_WORD16 EXPR_SHOW) e
 packageExpr (RefW16 n) = packageRef n (exprCmdVal EXPR_WORD16 EXPR_REF)
 packageExpr (RemBindW16 b) = (exprCmdVal EXPR_WORD16 EXPR_BIND) ++ [fromIntegral b]
@@ -1713,7 +1836,7 @@ packageExpr (IfW16 e1 e2 e3) = packageIfBSubExpr (exprCmdVal EXPR_WORD16 EXPR_IF
 packageExpr (TestBW16 e1 e2) = packageTwoSubExpr (exprCmdVal EXPR_WORD16 EXPR_TSTB) e1 e2
 packageExpr (SetBW16 e1 e2) = packageTwoSubExpr (exprCmdVal EXPR_WORD16 EXPR_SETB) e1 e2
 packageExpr (ClrBW16 e1 e2) = packageTwoSubExpr (exprCmdVal EXPR_WORD16 EXPR_CLRB) e1 e2
-packageExpr (LitW32 w) = (exprCmdVal EXPR_WORD32 EXPR_LIT) ++ word32ToBytes w
+packageExpr (LitW32 w) = packageLit EXPR_WORD32 w (word32ToBytes w)
 packageExpr (ShowW32 e) = packageSubExpr (exprCmdVal EXPR_WORD32 EXPR_SHOW) e
 packageExpr (RefW32 n) = packageRef n (exprCmdVal EXPR_WORD32 EXPR_REF)
 packageExpr (RemBindW32 b) = (exprCmdVal EXPR_WORD32 EXPR_BIND) ++ [fromIntegral b]
@@ -1738,7 +1861,7 @@ packageExpr (IfW32 e1 e2 e3) = packageIfBSubExpr (exprCmdVal EXPR_WORD32 EXPR_IF
 packageExpr (TestBW32 e1 e2) = packageTwoSubExpr (exprCmdVal EXPR_WORD32 EXPR_TSTB) e1 e2
 packageExpr (SetBW32 e1 e2) = packageTwoSubExpr (exprCmdVal EXPR_WORD32 EXPR_SETB) e1 e2
 packageExpr (ClrBW32 e1 e2) = packageTwoSubExpr (exprCmdVal EXPR_WORD32 EXPR_CLRB) e1 e2
-packageExpr (LitI8 w) = (exprCmdVal EXPR_INT8 EXPR_LIT) ++ [fromIntegral w]
+packageExpr (LitI8 w) = packageLit EXPR_INT8 (zigZag32 $ fromIntegral w) [fromIntegral w]
 packageExpr (ShowI8 e) = packageSubExpr (exprCmdVal EXPR_INT8 EXPR_SHOW) e
 packageExpr (RefI8 n) = packageRef n (exprCmdVal EXPR_INT8 EXPR_REF)
 packageExpr (RemBindI8 b) = (exprCmdVal EXPR_INT8 EXPR_BIND) ++ [fromIntegral b]
@@ -1763,7 +1886,7 @@ packageExpr (IfI8 e1 e2 e3) = packageIfBSubExpr (exprCmdVal EXPR_INT8 EXPR_IF) e
 packageExpr (TestBI8 e1 e2) = packageTwoSubExpr (exprCmdVal EXPR_INT8 EXPR_TSTB) e1 e2
 packageExpr (SetBI8 e1 e2) = packageTwoSubExpr (exprCmdVal EXPR_INT8 EXPR_SETB) e1 e2
 packageExpr (ClrBI8 e1 e2) = packageTwoSubExpr (exprCmdVal EXPR_INT8 EXPR_CLRB) e1 e2
-packageExpr (LitI16 w) = (exprCmdVal EXPR_INT16 EXPR_LIT) ++ word16ToBytes (fromIntegral w)
+packageExpr (LitI16 w) = packageLit EXPR_INT16 (zigZag32 $ fromIntegral w) (word16ToBytes (fromIntegral w))
 packageExpr (ShowI16 e) = packageSubExpr (exprCmdVal EXPR_INT16 EXPR_SHOW) e
 packageExpr (RefI16 n) = packageRef n (exprCmdVal EXPR_INT16 EXPR_REF)
 packageExpr (RemBindI16 b) = (exprCmdVal EXPR_INT16 EXPR_BIND) ++ [fromIntegral b]
@@ -1788,7 +1911,7 @@ packageExpr (IfI16 e1 e2 e3) = packageIfBSubExpr (exprCmdVal EXPR_INT16 EXPR_IF)
 packageExpr (TestBI16 e1 e2) = packageTwoSubExpr (exprCmdVal EXPR_INT16 EXPR_TSTB) e1 e2
 packageExpr (SetBI16 e1 e2) = packageTwoSubExpr (exprCmdVal EXPR_INT16 EXPR_SETB) e1 e2
 packageExpr (ClrBI16 e1 e2) = packageTwoSubExpr (exprCmdVal EXPR_INT16 EXPR_CLRB) e1 e2
-packageExpr (LitI32 w) = (exprCmdVal EXPR_INT32 EXPR_LIT) ++ word32ToBytes (fromIntegral w)
+packageExpr (LitI32 w) = packageLit EXPR_INT32 (zigZag32 w) (word32ToBytes (fromIntegral w))
 packageExpr (ShowI32 e) = packageSubExpr (exprCmdVal EXPR_INT32 EXPR_SHOW) e
 packageExpr (RefI32 n) = packageRef n (exprCmdVal EXPR_INT32 EXPR_REF)
 packageExpr (RemBindI32 b) = (exprCmdVal EXPR_INT32 EXPR_BIND) ++ [fromIntegral b]
@@ -1813,7 +1936,7 @@ packageExpr (IfI32 e1 e2 e3) = packageIfBSubExpr (exprCmdVal EXPR_INT32 EXPR_IF)
 packageExpr (TestBI32 e1 e2) = packageTwoSubExpr (exprCmdVal EXPR_INT32 EXPR_TSTB) e1 e2
 packageExpr (SetBI32 e1 e2) = packageTwoSubExpr (exprCmdVal EXPR_INT32 EXPR_SETB) e1 e2
 packageExpr (ClrBI32 e1 e2) = packageTwoSubExpr (exprCmdVal EXPR_INT32 EXPR_CLRB) e1 e2
-packageExpr (LitI w) = (exprCmdVal EXPR_INT32 EXPR_LIT) ++ word32ToBytes (fromIntegral w)
+packageExpr (LitI w) = packageLit EXPR_INT32 (zigZag32 $ fromIntegral w) (word32ToBytes (fromIntegral w))
 packageExpr (ShowI e) = packageSubExpr (exprCmdVal EXPR_INT32 EXPR_SHOW) e
 packageExpr (RefI n) = packageRef n (exprCmdVal EXPR_INT32 EXPR_REF)
 packageExpr (RemBindI b) = (exprCmdVal EXPR_INT32 EXPR_BIND) ++ [fromIntegral b]
@@ -1848,7 +1971,13 @@ packageExpr (PackList8 es) = (exprLCmdVal EXPRL_PACK) ++ [fromIntegral $ length
 packageExpr (SliceList8 e1 e2 e3) = packageThreeSubExpr (exprLCmdVal EXPRL_SLIC) e1 e2 e3
 -- TBD fix below with reverse op code
 packageExpr (RevList8 e1) = packageSubExpr (exprLCmdVal EXPRL_LEN) e1
-packageExpr (LitFloat f) = (exprFCmdVal EXPRF_LIT) ++ floatToBytes f
+packageExpr (LitFloat f) =
+    if isNaN f || isInfinite f || isNegativeZero f || abs f >= 16777216 ||
+       fromIntegral fi /= f
+    then (exprFCmdVal EXPRF_LIT) ++ floatToBytes f
+    else packageLit EXPR_FLOAT (zigZag32 fi) (floatToBytes f)
+  where
+    fi = truncate f :: Int32
 packageExpr (ShowFloat e1 e2) = packageTwoSubExpr (exprFCmdVal EXPRF_SHOW) e1 e2
 packageExpr (RefFloat n) = packageRef n (exprFCmdVal EXPRF_REF)
 packageExpr (RemBindFloat b) = (exprFCmdVal EXPRF_BIND) ++ [fromIntegral b]
@@ -1953,13 +2082,23 @@ unpackageResponse (cmdWord:args)
       (BC_RESP_ITERATE , [t,l,b1,b2,b3,b4]) | t == toW8 EXPR_FLOAT && l == toW8 EXPR_LIT
                                       -> IterateFloatReply $ bytesToFloat (b1, b2, b3, b4)
       (BS_RESP_DEBUG, [])                    -> DebugResp
+      (BS_RESP_STATS, [])                    -> StatsReply Nothing
+      (BS_RESP_STATS, ss)                    -> StatsReply (Just (unpackStats ss))
+      (BS_RESP_ARENA_STATS, [s0,s1,f0,f1,l0,l1,n0,n1])
+                                             -> ArenaReply (Just (ArenaStats (bytesToWord16 (s0,s1))
+                                                                             (bytesToWord16 (f0,f1))
+                                                                             (bytesToWord16 (l0,l1))
+                                                                             (bytesToWord16 (n0,n1))))
+      (BS_RESP_ARENA_STATS, _)               -> ArenaReply Nothing
       (BS_RESP_VERSION, [majV, minV])        -> Firmware (bytesToWord16 (majV,minV))
+      (BC_RESP_SET_BAUD, [_t,_l,b])          -> SetBaudReply (if b == 0 then False else True)
       (BS_RESP_TYPE, [p])                    -> ProcessorType p
       (BS_RESP_MICROS, [_t,_l,m0,m1,m2,m3])  -> MicrosReply (bytesToWord32 (m0,m1,m2,m3))
       (BS_RESP_MILLIS, [_t,_l,m0,m1,m2,m3])  -> MillisReply (bytesToWord32 (m0,m1,m2,m3))
       (BS_RESP_STRING, rest)                 -> StringMessage (getString rest)
       (DIG_RESP_READ_PIN, [_t,_l,b])         -> DigitalReply b
       (DIG_RESP_READ_PORT, [_t,_l,b])        -> DigitalPortReply b
+      (DIG_RESP_SAMPLES, t0:t1:t2:t3:ss)     -> PinSamples (bytesToWord32 (t0,t1,t2,t3)) (unpackSamples ss)
       (ALG_RESP_READ_PIN, [_t,_l,bl,bh])     -> AnalogReply (bytesToWord16 (bl,bh))
       (I2C_RESP_READ, _:_:_:xs)              -> I2CReply xs
       (SER_RESP_AVAIL, [_t, _l, w0])         -> SerialAvailableReply w0
@@ -1974,13 +2113,20 @@ unpackageResponse (cmdWord:args)
       (SCHED_RESP_BOOT, [_t,_l,b])           -> BootTaskResp b
       (SCHED_RESP_QUERY_ALL, _:_:_:ts)       -> QueryAllTasksReply ts
       (SCHED_RESP_QUERY, ts) | length ts == 0 ->
-          QueryTaskReply Nothing
-      (SCHED_RESP_QUERY, ts) | length ts >= 9 ->
-          let ts0:ts1:tl0:tl1:tp0:tp1:tt0:tt1:tt2:tt3:_ = ts
+          QueryTaskReply Nothing Nothing
+      (SCHED_RESP_QUERY, ts) | length ts >= 10 ->
+          let ts0:ts1:tl0:tl1:tp0:tp1:tt0:tt1:tt2:tt3:ss = ts
           in QueryTaskReply (Just (bytesToWord16 (ts0,ts1),
                                    bytesToWord16 (tl0,tl1),
                                    bytesToWord16 (tp0,tp1),
                                    bytesToWord32 (tt0,tt1,tt2,tt3)))
+                            (unpackTaskStats ss)
+      (SCHED_RESP_OVERRUNS, [_t,_l,ol,oh])   -> QueryOverrunsReply (bytesToWord16 (ol,oh))
+      (SCHED_RESP_TAKE_SEM, [_t,_l,b])       -> TakeSemReply (if b == 0 then False else True)
+      (SCHED_RESP_QUERY_SEM, [])             -> QuerySemReply Nothing
+      (SCHED_RESP_QUERY_SEM, [cl,ch,w])      -> QuerySemReply (Just (bytesToWord16 (cl,ch), w))
+      (SCHED_RESP_QUEUE_SEND, [_t,_l,b])     -> QueueSendReply (if b == 0 then False else True)
+      (SCHED_RESP_QUEUE_RECV, vs)            -> QueueReceiveReply vs
       (REF_RESP_READ , [t,l,b]) | t == toW8 EXPR_BOOL && l == toW8 EXPR_LIT
                                       -> ReadRefBReply (if b == 0 then False else True)
       (REF_RESP_READ , [t,l,b]) | t == toW8 EXPR_WORD8 && l == toW8 EXPR_LIT
@@ -2001,9 +2147,40 @@ unpackageResponse (cmdWord:args)
                                       -> ReadRefFloatReply $ bytesToFloat (b1, b2, b3, b4)
       (REF_RESP_NEW , [_t,_l,w])      -> NewReply w
       (REF_RESP_NEW , [])             -> FailedNewRef
+      (SEQ_RESP_ACK , [a,w])          -> SeqAck a w
+      (SEQ_RESP_NAK , [a,w])          -> SeqNak a w
+      (STREAM_RESP_ACK , [a,w])       -> StreamAck a w
+      (STREAM_RESP_NAK , [a,w])       -> StreamNak a w
+      (STREAM_RESP_END , [ok])        -> StreamEndReply (ok /= 0)
       _                               -> Unimplemented (Just (show cmd)) args
   | True
   = Unimplemented Nothing (cmdWord : args)
+  where
+    -- Five 32 bit counters, followed by a histogram for each of the 16
+    -- command types, with as many 16 bit bins as the firmware keeps.
+    unpackStats ss = ProtocolStats (word32At 0) (word32At 4) (word32At 8) (word32At 12) (word32At 16)
+                                   (chunk bins $ word16s $ drop 20 ss)
+      where
+        word32At n = case drop n ss of
+                       (a:b:c:d:_) -> bytesToWord32 (a,b,c,d)
+                       _           -> 0
+        bins = max 1 ((length ss - 20) `div` 32)
+    -- Three 32 bit counters, followed by the start latency histogram, if
+    -- the firmware keeps task statistics.
+    unpackTaskStats (a0:a1:a2:a3:c0:c1:c2:c3:m0:m1:m2:m3:hs@(_:_)) =
+        Just $ TaskStats (bytesToWord32 (a0,a1,a2,a3)) (bytesToWord32 (c0,c1,c2,c3))
+                         (bytesToWord32 (m0,m1,m2,m3)) (word16s hs)
+    unpackTaskStats _ = Nothing
+    word16s (l:h:ws) = bytesToWord16 (l,h) : word16s ws
+    word16s _        = []
+    chunk _ [] = []
+    chunk n ws = take n ws : chunk n (drop n ws)
+    -- Each sample is a slot byte, with the high bit set for analog
+    -- pins, followed by a one byte digital or two byte analog value.
+    unpackSamples [] = []
+    unpackSamples (sl:vl:vh:ss) | sl .&. 0x80 /= 0 = (sl .&. 0x7F, bytesToWord16 (vl,vh)) : unpackSamples ss
+    unpackSamples (sl:v:ss)                        = (sl, fromIntegral v) : unpackSamples ss
+    unpackSamples _  = []
 
 -- This is how we match responses with queries
 parseQueryResult :: ArduinoPrimitive a -> Response -> Maybe a
@@ -2041,8 +2218,20 @@ parseQueryResult (Stepper4PinE _ _ _ _ _) (Stepper4PinReply st) = Just (lit st)
 parseQueryResult (StepperStepE _ _) StepperStepReply = Just ()
 parseQueryResult QueryAllTasks (QueryAllTasksReply ts) = Just ts
 parseQueryResult QueryAllTasksE (QueryAllTasksReply ts) = Just (lit ts)
-parseQueryResult (QueryTask _) (QueryTaskReply tr) = Just tr
-parseQueryResult (QueryTaskE _) (QueryTaskReply tr) = Just tr
+parseQueryResult (QueryTask _) (QueryTaskReply tr _) = Just tr
+parseQueryResult (QueryTaskE _) (QueryTaskReply tr _) = Just tr
+parseQueryResult (QueryTaskStats _) (QueryTaskReply _ ts) = Just ts
+parseQueryResult (QueryTaskStatsE _) (QueryTaskReply _ ts) = Just ts
+parseQueryResult (QueryOverruns _) (QueryOverrunsReply o) = Just o
+parseQueryResult (QueryOverrunsE _) (QueryOverrunsReply o) = Just (lit o)
+parseQueryResult (TakeSemTimed _ _) (TakeSemReply b) = Just b
+parseQueryResult (TakeSemTimedE _ _) (TakeSemReply b) = Just (lit b)
+parseQueryResult (QuerySem _) (QuerySemReply sr) = Just sr
+parseQueryResult (QuerySemE _) (QuerySemReply sr) = Just sr
+parseQueryResult (QueueSend _ _ _) (QueueSendReply b) = Just b
+parseQueryResult (QueueSendE _ _ _) (QueueSendReply b) = Just (lit b)
+parseQueryResult (QueueReceive _ _ _) (QueueReceiveReply vs) = queueValue vs
+parseQueryResult (QueueReceiveE _ _ _) (QueueReceiveReply vs) = lit <$> queueValue vs
 parseQueryResult (BootTaskE _) (BootTaskResp b) = Just (if b == 0 then lit False else lit True)
 parseQueryResult (NewRemoteRefBE _) (NewReply r) = Just $ RemoteRefB $ fromIntegral r
 parseQueryResult (NewRemoteRefW8E _) (NewReply r) = Just $ RemoteRefW8 $ fromIntegral r
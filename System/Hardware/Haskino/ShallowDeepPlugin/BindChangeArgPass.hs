@@ -81,8 +81,11 @@ comProcList = [ "systemReset"
               , "servoWriteE"
               , "servoWriteMicrosE"
               , "createTaskE"
+              , "swapTaskE"
               , "deleteTaskE"
               , "scheduleTaskE"
+              , "schedulePeriodicE"
+              , "taskBudgetE"
               , "attachIntE"
               , "detachIntE"
               , "interrupts"
@@ -90,6 +93,7 @@ comProcList = [ "systemReset"
               , "scheduleReset"
               , "giveSemE"
               , "takeSemE"
+              , "createQueueE"
               , "loopE"
               , "forInE"
               , "writeRemoteRefE"
@@ -116,6 +120,14 @@ comProcList = [ "systemReset"
               , "servoReadMicrosE"
               , "queryAllTasksE"
               , "queryTaskE"
+              , "queryTaskStatsE"
+              , "queryOverrunsE"
+              , "takeSemTimedE"
+              , "querySemE"
+              , "sendQueueE"
+              , "trySendQueueE"
+              , "receiveQueueE"
+              , "tryReceiveQueueE"
               , "bootTaskE"
               , "readRemoteRefE"
               , "newRemoteRefE"
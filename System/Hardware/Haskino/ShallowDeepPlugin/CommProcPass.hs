@@ -70,10 +70,16 @@ xlatList = [  XlatEntry (thNameToId 'System.Hardware.Haskino.setPinMode)
                         (thNameToId 'System.Hardware.Haskino.servoWriteMicrosE)
             , XlatEntry (thNameToId 'System.Hardware.Haskino.createTask)
                         (thNameToId 'System.Hardware.Haskino.createTaskE)
+            , XlatEntry (thNameToId 'System.Hardware.Haskino.swapTask)
+                        (thNameToId 'System.Hardware.Haskino.swapTaskE)
             , XlatEntry (thNameToId 'System.Hardware.Haskino.deleteTask)
                         (thNameToId 'System.Hardware.Haskino.deleteTaskE)
             , XlatEntry (thNameToId 'System.Hardware.Haskino.scheduleTask)
                         (thNameToId 'System.Hardware.Haskino.scheduleTaskE)
+            , XlatEntry (thNameToId 'System.Hardware.Haskino.schedulePeriodic)
+                        (thNameToId 'System.Hardware.Haskino.schedulePeriodicE)
+            , XlatEntry (thNameToId 'System.Hardware.Haskino.taskBudget)
+                        (thNameToId 'System.Hardware.Haskino.taskBudgetE)
             , XlatEntry (thNameToId 'System.Hardware.Haskino.attachInt)
                         (thNameToId 'System.Hardware.Haskino.attachIntE)
             , XlatEntry (thNameToId 'System.Hardware.Haskino.detachInt)
@@ -82,6 +88,20 @@ xlatList = [  XlatEntry (thNameToId 'System.Hardware.Haskino.setPinMode)
                         (thNameToId 'System.Hardware.Haskino.giveSemE)
             , XlatEntry (thNameToId 'System.Hardware.Haskino.takeSem)
                         (thNameToId 'System.Hardware.Haskino.takeSemE)
+            , XlatEntry (thNameToId 'System.Hardware.Haskino.takeSemTimed)
+                        (thNameToId 'System.Hardware.Haskino.takeSemTimedE)
+            , XlatEntry (thNameToId 'System.Hardware.Haskino.querySem)
+                        (thNameToId 'System.Hardware.Haskino.querySemE)
+            , XlatEntry (thNameToId 'System.Hardware.Haskino.createQueue)
+                        (thNameToId 'System.Hardware.Haskino.createQueueE)
+            , XlatEntry (thNameToId 'System.Hardware.Haskino.sendQueue)
+                        (thNameToId 'System.Hardware.Haskino.sendQueueE)
+            , XlatEntry (thNameToId 'System.Hardware.Haskino.trySendQueue)
+                        (thNameToId 'System.Hardware.Haskino.trySendQueueE)
+            , XlatEntry (thNameToId 'System.Hardware.Haskino.receiveQueue)
+                        (thNameToId 'System.Hardware.Haskino.receiveQueueE)
+            , XlatEntry (thNameToId 'System.Hardware.Haskino.tryReceiveQueue)
+                        (thNameToId 'System.Hardware.Haskino.tryReceiveQueueE)
             , XlatEntry (thNameToId 'System.Hardware.Haskino.writeRemoteRef)
                         (thNameToId 'System.Hardware.Haskino.writeRemoteRefE)
             , XlatEntry (thNameToId 'System.Hardware.Haskino.modifyRemoteRef)
@@ -132,6 +152,10 @@ xlatList = [  XlatEntry (thNameToId 'System.Hardware.Haskino.setPinMode)
                         (thNameToId 'System.Hardware.Haskino.queryAllTasksE)
             , XlatEntry (thNameToId 'System.Hardware.Haskino.queryTask)
                         (thNameToId 'System.Hardware.Haskino.queryTaskE)
+            , XlatEntry (thNameToId 'System.Hardware.Haskino.queryTaskStats)
+                        (thNameToId 'System.Hardware.Haskino.queryTaskStatsE)
+            , XlatEntry (thNameToId 'System.Hardware.Haskino.queryOverruns)
+                        (thNameToId 'System.Hardware.Haskino.queryOverrunsE)
             , XlatEntry (thNameToId 'System.Hardware.Haskino.bootTaskE)
                         (thNameToId 'System.Hardware.Haskino.bootTaskE)
             , XlatEntry (thNameToId 'System.Hardware.Haskino.newRemoteRef)
@@ -66,6 +66,8 @@ showCommand (ServoWriteE sv w) = showCommand2 "ServoWriteE " sv w
 showCommand (ServoWriteMicrosE sv w) = showCommand2 "ServoWriteMicrosE" sv w
 showCommand (DeleteTaskE tid) = showCommand1 "DeleteTaskE" tid
 showCommand (ScheduleTaskE tid tt) = showCommand2 "ScheduleTaskE" tid tt
+showCommand (SchedulePeriodicE tid tt p) = showCommand3 "SchedulePeriodicE" tid tt p
+showCommand (TaskBudgetE tid b) = showCommand2 "TaskBudgetE" tid b
 showCommand ScheduleResetE = showCommand0 "ScheduleReset"
 showCommand (AttachIntE p t m) = showCommand3 "AttachIntE" p t m
 showCommand (DetachIntE p) = showCommand1 "DetachIntE " p
@@ -73,9 +75,13 @@ showCommand (InterruptsE) = showCommand0 "Interrupts"
 showCommand (NoInterruptsE) = showCommand0 "NoInterrupts"
 showCommand (GiveSemE i) = showCommand1 "GiveSemE"  i
 showCommand (TakeSemE i) = showCommand1 "TakeSemE" i
+showCommand (CreateQueueE q n) = showCommand2 "CreateQueueE" q n
 showCommand (CreateTaskE tid m) = do
     (_, ts) <- showCodeBlock m
     return $ "CreateTaskE " ++ show tid ++ "\n" ++ ts
+showCommand (SwapTaskE tid m k) = do
+    (_, ts) <- showCodeBlock m
+    return $ "SwapTaskE " ++ show tid ++ " " ++ show k ++ "\n" ++ ts
 showCommand (WriteRemoteRefBE (RemoteRefB i) e) =
     showCommand2 "WriteRemoteRefBE" i e
 showCommand (WriteRemoteRefW8E (RemoteRefW8 i) e) =
@@ -346,6 +352,26 @@ showCodeBlock (Arduino commands) = do
           return $ RemBindList8 i
       showProcedure (QueryTask _) = showShallow0Procedure "QueryTask" Nothing
       showProcedure (QueryTaskE _) = showShallow0Procedure "QueryTaskE" Nothing
+      showProcedure (QueryTaskStats _) = showShallow0Procedure "QueryTaskStats" Nothing
+      showProcedure (QueryTaskStatsE _) = showShallow0Procedure "QueryTaskStatsE" Nothing
+      showProcedure (QueryOverruns t) = showShallow1Procedure "QueryOverruns" t 0
+      showProcedure (QueryOverrunsE t) = do
+          i <- showDeep1Procedure "QueryOverrunsE" t
+          return $ RemBindW16 i
+      showProcedure (TakeSemTimed s t) = showShallow2Procedure "TakeSemTimed" s t False
+      showProcedure (TakeSemTimedE s t) = do
+          i <- showDeep2Procedure "TakeSemTimedE" s t
+          return $ RemBindB i
+      showProcedure (QuerySem _) = showShallow0Procedure "QuerySem" Nothing
+      showProcedure (QuerySemE _) = showShallow0Procedure "QuerySemE" Nothing
+      showProcedure (QueueSend q b v) = showShallow3Procedure "QueueSend" q b v False
+      showProcedure (QueueSendE q b v) = do
+          i <- showDeep3Procedure "QueueSendE" q b v
+          return $ RemBindB i
+      showProcedure (QueueReceive q b d) = showShallow3Procedure "QueueReceive" q b d d
+      showProcedure (QueueReceiveE q b d) = do
+          i <- showDeep3Procedure "QueueReceiveE" q b d
+          return $ remBind i
       showProcedure (BootTaskE tids) = do
           i <- showDeep1Procedure "BootTaskE" tids
           return $ RemBindB i
@@ -11,7 +11,7 @@
 -------------------------------------------------------------------------------
 module System.Hardware.Haskino.Utils where
 
-import           Data.Bits              (shiftL, shiftR, (.&.), (.|.))
+import           Data.Bits              (shiftL, shiftR, xor, (.&.), (.|.))
 import qualified Data.ByteString        as B
 import           Data.Char              (isAlphaNum, isAscii, isSpace, chr, ord)
 import           Data.Int               (Int32)
@@ -87,6 +87,29 @@ word16ToBytes i = map fromIntegral [ i .&. 0xFF, (i `shiftR`  8) .&. 0xFF ]
 bytesToWord16 :: (Word8, Word8) -> Word16
 bytesToWord16 (a, b) = fromIntegral a .|. fromIntegral b `shiftL` 8
 
+-- | Zigzag encode a signed value, so small negative numbers stay small
+zigZag32 :: Int32 -> Word32
+zigZag32 i = fromIntegral ((i `shiftL` 1) `xor` (i `shiftR` 31))
+
+-- | Inverse conversion for zigZag32
+unZigZag32 :: Word32 -> Int32
+unZigZag32 w = fromIntegral (w `shiftR` 1) `xor` negate (fromIntegral (w .&. 1))
+
+-- | Convert a word to base 128 varint bytes, low order group first
+varintToBytes :: Word32 -> [Word8]
+varintToBytes w
+  | w < 0x80  = [fromIntegral w]
+  | otherwise = (fromIntegral (w .&. 0x7F) .|. 0x80) : varintToBytes (w `shiftR` 7)
+
+-- | Inverse conversion for varintToBytes, also returning the unused bytes
+bytesToVarint :: [Word8] -> (Word32, [Word8])
+bytesToVarint []     = (0, [])
+bytesToVarint (b:bs)
+  | b .&. 0x80 == 0 = (fromIntegral b, bs)
+  | otherwise       = (fromIntegral (b .&. 0x7F) .|. (v `shiftL` 7), bs')
+  where
+    (v, bs') = bytesToVarint bs
+
 -- | Convert a float to it's bytes, as would be required by Arduino comms
 -- | Note: Little endian format, which is Arduino native
 floatToBytes :: Float -> [Word8]
@@ -11,24 +11,18 @@ static bool handleWritePin(int size, const byte *msg, CONTEXT *context);
 static bool handleTonePin(int size, const byte *msg, CONTEXT *context);
 static bool handleNoTonePin(int size, const byte *msg, CONTEXT *context);
 
+static const MessageHandler analogHandlers[] PROGMEM =
+    {
+    handleReadPin,           // ALG_CMD_READ_PIN
+    handleWritePin,          // ALG_CMD_WRITE_PIN
+    handleTonePin,           // ALG_CMD_TONE_PIN
+    handleNoTonePin,         // ALG_CMD_NOTONE_PIN
+    };
+
 bool parseAnalogMessage(int size, const byte *msg, CONTEXT *context)
     {
-    switch (msg[0] ) 
-        {
-        case ALG_CMD_READ_PIN:
-            return handleReadPin(size, msg, context);
-            break;
-        case ALG_CMD_WRITE_PIN:
-            return handleWritePin(size, msg, context);
-            break;
-        case ALG_CMD_TONE_PIN:
-            return handleTonePin(size, msg, context);
-            break;
-        case ALG_CMD_NOTONE_PIN:
-            return handleNoTonePin(size, msg, context);
-            break;
-        }
-    return false;
+    return dispatchMessage(analogHandlers, DISPATCH_SIZE(analogHandlers),
+                           size, msg, context);
     }
 
 static bool handleReadPin(int size, const byte *msg, CONTEXT *context)
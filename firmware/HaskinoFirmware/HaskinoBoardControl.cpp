@@ -16,31 +16,25 @@ static bool handleDelayMillis(int size, const byte *msg, CONTEXT *context);
 static bool handleDelayMicros(int size, const byte *msg, CONTEXT *context);
 static bool handleIterate(int size, const byte *msg, CONTEXT *context);
 static bool handleIfThenElse(int size, const byte *msg, CONTEXT *context);
+static bool handleBatch(int size, const byte *msg, CONTEXT *context);
+static bool handleSetBaud(int size, const byte *msg, CONTEXT *context);
+
+static const MessageHandler boardControlHandlers[] PROGMEM =
+    {
+    handleSystemReset,       // BC_CMD_SYSTEM_RESET
+    handleSetPinMode,        // BC_CMD_SET_PIN_MODE
+    handleDelayMillis,       // BC_CMD_DELAY_MILLIS
+    handleDelayMicros,       // BC_CMD_DELAY_MICROS
+    handleIterate,           // BC_CMD_ITERATE
+    handleIfThenElse,        // BC_CMD_IF_THEN_ELSE
+    handleBatch,             // BC_CMD_BATCH
+    handleSetBaud,           // BC_CMD_SET_BAUD
+    };
 
 bool parseBoardControlMessage(int size, const byte *msg, CONTEXT *context)
     {
-    switch (msg[0] ) 
-        {
-        case BC_CMD_SYSTEM_RESET:
-            return handleSystemReset(size, msg, context);
-            break;
-        case BC_CMD_SET_PIN_MODE:
-            return handleSetPinMode(size, msg, context);
-            break;
-        case BC_CMD_DELAY_MILLIS:
-            return handleDelayMillis(size, msg, context);
-            break;
-        case BC_CMD_DELAY_MICROS:
-            return handleDelayMicros(size, msg, context);
-            break;
-        case BC_CMD_ITERATE:
-            return handleIterate(size, msg, context);
-            break;
-        case BC_CMD_IF_THEN_ELSE:
-            return handleIfThenElse(size, msg, context);
-            break;
-        }
-    return false;
+    return dispatchMessage(boardControlHandlers, DISPATCH_SIZE(boardControlHandlers),
+                           size, msg, context);
     }
 
 static bool handleSetPinMode(int size, const byte *msg, CONTEXT *context)
@@ -78,10 +72,21 @@ static bool handleDelayMicros(int size, const byte *msg, CONTEXT *context)
     byte *expr = (byte *) &msg[2];
     byte bind = msg[1];
 
-    uint32_t micros = evalWord16Expr(&expr, context);
-    delayMicroseconds(micros);
-    sendReply(0, BC_RESP_DELAY, NULL, context, bind);
-    return false;
+    uint32_t micros = evalWord32Expr(&expr, context);
+
+    if (context->task)
+        {
+        delayRunningTaskMicros(micros);
+        return true;
+        }
+    else 
+        {
+        // delayMicroseconds() only takes 16 bits on AVR
+        delay(micros / 1000);
+        delayMicroseconds(micros % 1000);
+        sendReply(0, BC_RESP_DELAY, NULL, context, bind);
+        return false;
+        }
     }
 
 static bool handleSystemReset(int size, const byte *msg, CONTEXT *context)
@@ -242,3 +247,63 @@ static bool handleIfThenElse(int size, const byte *msg, CONTEXT *context)
     return rescheduled;
     }
 
+
+static bool handleBatch(int size, const byte *msg, CONTEXT *context)
+    {
+    int currPos = 1;
+    bool rescheduled = false;
+
+    // A batch is a sequence of commands, each preceded by its length 
+    // encoded as in a code block.  Unlike a code block, the commands are
+    // executed at the current block level, so they behave exactly as if 
+    // they had each been sent in their own frame, except that their
+    // replies are coalesced into as few frames as possible.
+    startReplyBatch();
+    while (currPos < size)
+        {
+        const byte *cmd = &msg[currPos];
+        uint16_t cmdSize;
+
+        if (cmd[0] != 0xFF)
+            {
+            cmdSize = cmd[0];
+            cmd += 1;
+            }
+        else
+            {
+            cmdSize = ((uint16_t) cmd[2]) << 8 |
+                      ((uint16_t) cmd[1]);
+            cmd += 3;
+            }
+
+        if (cmdSize == 0 || (cmd - msg) + cmdSize > size)
+            {
+#ifdef DEBUG
+            sendStringf("Batch: Bad length %d at %d", cmdSize, currPos);
+#endif
+            break;
+            }
+
+        rescheduled |= parseMessage(cmdSize, cmd, context);
+        currPos = (cmd - msg) + cmdSize;
+        }
+    endReplyBatch();
+
+    return rescheduled;
+    }
+
+static bool handleSetBaud(int size, const byte *msg, CONTEXT *context)
+    {
+    byte bind = msg[1];
+    byte *expr = (byte *) &msg[2];
+    byte rate = evalWord8Expr(&expr, context);
+    byte baudReply[3];
+
+    baudReply[0] = EXPR_BOOL;
+    baudReply[1] = EXPR_LIT;
+    // Only the host may change the rate, as it has to follow the change
+    baudReply[2] = (context->task == NULL) && requestBaudRate(rate);
+
+    sendReply(sizeof(baudReply), BC_RESP_SET_BAUD, baudReply, context, bind);
+    return false;
+    }
@@ -11,28 +11,24 @@ static bool handleRequestType(int size, const byte *msg, CONTEXT *context);
 static bool handleRequestMicros(int size, const byte *msg, CONTEXT *context);
 static bool handleRequestMillis(int size, const byte *msg, CONTEXT *context);
 static bool handleDebug(int size, const byte *msg, CONTEXT *context);
+static bool handleStats(int size, const byte *msg, CONTEXT *context);
+static bool handleArenaStats(int size, const byte *msg, CONTEXT *context);
+
+static const MessageHandler boardStatusHandlers[] PROGMEM =
+    {
+    handleRequestVersion,    // BS_CMD_REQUEST_VERSION
+    handleRequestType,       // BS_CMD_REQUEST_TYPE
+    handleRequestMicros,     // BS_CMD_REQUEST_MICROS
+    handleRequestMillis,     // BS_CMD_REQUEST_MILLIS
+    handleDebug,             // BS_CMD_DEBUG
+    handleStats,             // BS_CMD_STATS
+    handleArenaStats,        // BS_CMD_ARENA_STATS
+    };
 
 bool parseBoardStatusMessage(int size, const byte *msg, CONTEXT *context)
     {
-    switch (msg[0] ) 
-        {
-        case BS_CMD_REQUEST_VERSION:
-            return handleRequestVersion(size, msg, context);
-            break;
-        case BS_CMD_REQUEST_TYPE:
-            return handleRequestType(size, msg, context);
-            break;
-        case BS_CMD_REQUEST_MICROS:
-            return handleRequestMicros(size, msg, context);
-            break;
-        case BS_CMD_REQUEST_MILLIS:
-            return handleRequestMillis(size, msg, context);
-            break;
-        case BS_CMD_DEBUG:
-            return handleDebug(size, msg, context);
-            break;
-        }
-    return false;
+    return dispatchMessage(boardStatusHandlers, DISPATCH_SIZE(boardStatusHandlers),
+                           size, msg, context);
     }
 
 void sendVersionReply(CONTEXT *context, byte bind)
@@ -136,3 +132,50 @@ static bool handleDebug(int size, const byte *msg, CONTEXT *context)
         free(string);
     return false;
     }
+
+static bool handleStats(int size, const byte *msg, CONTEXT *context)
+    {
+    byte bind = msg[1];
+#ifdef INCLUDE_PROTOCOL_STATS
+    byte *expr = (byte *) &msg[2];
+    bool reset = evalBoolExpr(&expr, context);
+
+    // The statistics are too large for a bind, so they may only be 
+    // queried by the host, and an empty reply is sent otherwise.
+    if (context->currBlockLevel < 0)
+        {
+        sendReply(sizeof(PROTOCOL_STATS), BS_RESP_STATS, 
+                  (const byte *) getProtocolStats(), context, bind);
+        }
+    else
+        {
+        sendReply(0, BS_RESP_STATS, NULL, context, bind);
+        }
+    if (reset)
+        {
+        resetProtocolStats();
+        }
+#else
+    sendReply(0, BS_RESP_STATS, NULL, context, bind);
+#endif
+    return false;
+    }
+
+static bool handleArenaStats(int size, const byte *msg, CONTEXT *context)
+    {
+    byte bind = msg[1];
+    ARENA_STATS stats;
+
+    // As with the protocol statistics, these may only be queried by the host
+    if (context->currBlockLevel < 0)
+        {
+        schedulerArenaStats(&stats);
+        sendReply(sizeof(stats), BS_RESP_ARENA_STATS, 
+                  (const byte *) &stats, context, bind);
+        }
+    else
+        {
+        sendReply(0, BS_RESP_ARENA_STATS, NULL, context, bind);
+        }
+    return false;
+    }
@@ -0,0 +1,6 @@
+// Haskino boot tasks, run in place from flash
+// This empty image boots no tasks.  Replace it with the header written 
+// by writeFlashBootImage.
+static const byte bootImageFlash[] PROGMEM = {
+    0x00,
+    };
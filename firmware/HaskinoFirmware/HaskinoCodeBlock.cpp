@@ -1,15 +1,61 @@
 #include <Arduino.h>
 #include "HaskinoComm.h"
+#include "HaskinoCommands.h"
 #include "HaskinoConfig.h"
 
 #undef  DEBUG
 
+#ifdef BOOT_IMAGE_FLASH
+// Tasks booted from flash are run in place.  Each command is copied into
+// the stage for its block level before it is parsed, so the handlers and
+// the expression evaluator only ever read SRAM.  Commands which contain a
+// code block only have their start, up to the end of their expressions, 
+// staged, and their code block is run from flash, found from its place in
+// the stage.  writeFlashBootImage rejects any other command, or any such 
+// start, which does not fit the stage.
+static byte codeStage[MAX_BLOCK_LEVELS][CODE_STAGE_SIZE];
+static const byte *stageFlash[MAX_BLOCK_LEVELS];
+
+static bool runFlashCommand(uint16_t cmdSize, const byte *cmd, 
+                            int16_t level, CONTEXT *context)
+    {
+    byte cmdType = pgm_read_byte(cmd);
+    uint16_t copySize = cmdSize;
+
+    if (cmdSize > CODE_STAGE_SIZE)
+        {
+        if ((cmdType != BC_CMD_ITERATE && cmdType != BC_CMD_IF_THEN_ELSE) ||
+            (cmdType == BC_CMD_ITERATE && 
+             5 + pgm_read_byte(&cmd[4]) > CODE_STAGE_SIZE))
+            {
+#ifdef DEBUG
+            sendStringf("Flash cmd: S");
+#endif
+            return false;
+            }
+        copySize = CODE_STAGE_SIZE;
+        }
+
+    stageFlash[level] = cmd;
+    memcpy_P(codeStage[level], cmd, copySize);
+    return parseMessage(cmdSize, codeStage[level], context);
+    }
+
+static inline byte codeByte(const byte *code, bool inFlash)
+    {
+    return inFlash ? pgm_read_byte(code) : *code;
+    }
+#endif
+
 bool runCodeBlock(int blockSize, const byte * block, CONTEXT *context)
     {
     int currPos = 0;
     TASK *task = context->task;
     bool taskRescheduled;
     int16_t thisBlockLevel;
+#ifdef BOOT_IMAGE_FLASH
+    bool inFlash = task && task->flashData != NULL;
+#endif
 #ifdef DEBUG
     sendStringf("Run %d Block %d %d %d",task->id,task->rescheduled,context->recallBlockLevel,context->currBlockLevel);
 #endif
@@ -46,6 +92,14 @@ bool runCodeBlock(int blockSize, const byte * block, CONTEXT *context)
 #ifdef DEBUG
     sendStringf("Run Block Lvl %d",thisBlockLevel);
 #endif
+#ifdef BOOT_IMAGE_FLASH
+    if (inFlash && thisBlockLevel > 0)
+        {
+        // The block is within the command staged by the level above
+        block = stageFlash[thisBlockLevel - 1] + 
+                (block - codeStage[thisBlockLevel - 1]);
+        }
+#endif
 
     while (currPos < blockSize)
         {
@@ -56,6 +110,25 @@ bool runCodeBlock(int blockSize, const byte * block, CONTEXT *context)
         uint16_t cmdSize;
         const byte *cmd;
 
+#ifdef BOOT_IMAGE_FLASH
+        if (codeByte(msg, inFlash) != 0xFF)
+            {
+            cmdSize = codeByte(msg, inFlash);
+            cmd = &msg[1];
+            }
+        else
+            {
+            cmdSize = ((uint16_t) codeByte(&msg[2], inFlash)) << 8 |
+                      ((uint16_t) codeByte(&msg[1], inFlash));
+            cmd = &msg[3];
+            }
+
+        if (inFlash)
+            taskRescheduled = runFlashCommand(cmdSize, cmd, thisBlockLevel, 
+                                              context);
+        else
+            taskRescheduled = parseMessage(cmdSize, cmd, context); 
+#else
         if (msg[0] != 0xFF)
             {
             cmdSize = msg[0];
@@ -69,6 +142,7 @@ bool runCodeBlock(int blockSize, const byte * block, CONTEXT *context)
             }
 
         taskRescheduled = parseMessage(cmdSize, cmd, context); 
+#endif
 
         if (!taskRescheduled || thisBlockLevel == context->currBlockLevel)
             {
@@ -77,6 +151,17 @@ bool runCodeBlock(int blockSize, const byte * block, CONTEXT *context)
             currPos += cmdSize + 1;
             context->blockStatus[context->currBlockLevel].currPos = currPos;
             }
+#ifdef INCLUDE_TASK_BUDGET
+        if (task && !taskRescheduled && task->budget != 0 &&
+            micros() - task->sliceStart >= task->budget)
+            {
+            // The task has used up its budget for this run, so it yields
+            // as if it had delayed for no time, and resumes with the next
+            // command once the tasks and input which are due have run.
+            delayRunningTaskMicros(0);
+            taskRescheduled = true;
+            }
+#endif
         if (task && taskRescheduled)
             {
             if (!task->rescheduled)
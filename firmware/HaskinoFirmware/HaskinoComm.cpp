@@ -1,6 +1,7 @@
 #include <stdarg.h>
 #include <Arduino.h>
 #include <HardwareSerial.h>
+#include <avr/pgmspace.h>
 #include "HaskinoAnalog.h"
 #include "HaskinoBoardControl.h"
 #include "HaskinoBoardStatus.h"
@@ -18,133 +19,664 @@
 #include "HaskinoServo.h"
 #include "HaskinoStepper.h"
 
-static int messageCount = 0;
-static int processingEscapeState = 0;
-static byte inputData[MESSAGE_MAX_SIZE];
+// Received frames are unescaped into a ring buffer as bytes are drained
+// from the UART.  Each frame is preceded by a two byte length header, which
+// is filled in when the closing frame flag arrives and the checksum has
+// been verified, so only complete, valid frames are ever dispatched.
+#define RX_BUFFER_MASK      (RX_BUFFER_SIZE - 1)
+#define RX_HEADER_SIZE      2
+// Largest frame, including its check bytes, before it is discarded.
+#define RX_FRAME_MAX        (MESSAGE_MAX_SIZE + SEQ_CRC_SIZE)
+// Most bytes taken from the UART in one drain, so a sustained stream of 
+// input can not hold off the scheduler.
+#define RX_DRAIN_MAX        64
+
+static byte rxBuffer[RX_BUFFER_SIZE];
+static uint16_t rxHead = 0;
+static uint16_t rxTail = 0;
+static uint16_t rxFrameStart = 0;
+static uint16_t rxFrameLen = 0;
+static byte rxFrameCount = 0;
+static byte rxChecksum = 0;
+static byte rxLast = 0;
+static bool rxEscape = false;
+static bool rxDiscard = false;
+static byte rxFirst = 0;
+static uint16_t rxCrc = SEQ_CRC_INIT;
+
+// Sequenced frames carry a sequence number after the SEQ_FRAME header and
+// are protected by a CRC-16 in place of the checksum.  Frames are executed
+// only in sequence order, and acked with the sequence number of the last
+// frame executed.  A frame from beyond a gap is dropped and answered with
+// a nak, so the host retransmits starting from the first lost frame.
+static byte seqExpected = 0;
+static bool seqAckPending = false;
+static bool seqNakSent = false;
+
+// Stream frames carry the code of the task opened by SCHED_CMD_STREAM_TASK,
+// and are written straight into the task as they are unescaped, so a task
+// of any size is uploaded without passing through the ring buffer.  The
+// last two bytes of a frame are held back until the next byte arrives, as
+// they may turn out to be its CRC.  Stream frames are taken in sequence
+// order only, and acked like sequenced frames.  Once the last of the task
+// has arrived, its CRC is checked and the result sent in STREAM_RESP_END.
+static byte streamExpected = 0;
+static byte streamHold[SEQ_CRC_SIZE];
+static bool streamAckPending = false;
+static bool streamNakPending = false;
+static bool streamNakSent = false;
+static bool streamDone = false;
+
+#ifdef INCLUDE_PROTOCOL_STATS
+static PROTOCOL_STATS protocolStats;
+#define STATS_COUNT(counter)    (protocolStats.counter++)
+#else
+#define STATS_COUNT(counter)
+#endif
+
+// Baud rates which may be selected with BC_CMD_SET_BAUD, indexed by the
+// rate code sent by the host.
+static const uint32_t baudRates[] = {115200, 500000, 1000000, 2000000};
+#define NUM_BAUD_RATES      (sizeof(baudRates) / sizeof(baudRates[0]))
+static byte baudCurrent = 0;
+static byte baudPending = 0;
+
+// After a switch the new rate is on trial until the host sends a valid
+// frame at it, or BAUD_CONFIRM_MILLIS pass and the old rate is restored.
+// The trial is checked on each call to handleInput(), so tasks keep 
+// running while the host confirms.
+static bool baudConfirming = false;
+static bool baudHeard = false;
+static uint32_t baudSwitchMillis;
+
+// CRC-16/CCITT (polynomial 0x1021), high byte first
+static const uint16_t crc16Table[256] PROGMEM = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+    0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+    0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+    0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+    0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+    0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+    0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+    0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+    0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+    0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+    0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+    0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+    0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+    0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+    0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+    0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+    0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+    0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+    0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+    0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+    0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+    0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
+    };
 
 static void processChar(byte c);
+static void streamChar(byte c);
+static void endStreamFrame();
+static void sendStreamReply(byte replyType);
+static void drainInput();
+static void dispatchFrame();
+static void sendSeqReply(byte replyType);
+static void discardFrame();
+static void changeBaudRate();
+static void confirmBaudRate();
+static void sendReplyFrame(int count, byte replyType, const byte *reply);
+#ifdef INCLUDE_PROTOCOL_STATS
+static void recordLatency(byte cmdType, uint32_t elapsed);
+#endif
 
-int processingMessage() 
+uint16_t crc16Update(uint16_t crc, byte c)
     {
-    return (messageCount != 0);
+    return (crc << 8) ^ pgm_read_word(&crc16Table[(crc >> 8) ^ c]);
     }
 
-bool parseMessage(int size, const byte *msg, CONTEXT *context)
+int processingMessage() 
     {
-    switch (msg[0] & CMD_TYPE_MASK) 
-        {
-        case BC_CMD_TYPE:
-            return parseBoardControlMessage(size, msg, context);
-            break;
-        case BS_CMD_TYPE:
-            return parseBoardStatusMessage(size, msg, context);
-            break;
+    return (rxFrameLen != 0 || rxFrameCount != 0);
+    }
+
+// Parsers for each command type, indexed by the upper nibble of the
+// command.  Types which are not included in this build are NULL.
 #ifdef INCLUDE_DIG_CMDS
-        case DIG_CMD_TYPE:
-            return parseDigitalMessage(size, msg, context);
-            break;
+#define DIG_PARSER      parseDigitalMessage
+#else
+#define DIG_PARSER      NULL
 #endif
 #ifdef INCLUDE_ALG_CMDS
-        case ALG_CMD_TYPE:
-            return parseAnalogMessage(size, msg, context);
-            break;
+#define ALG_PARSER      parseAnalogMessage
+#else
+#define ALG_PARSER      NULL
 #endif
 #ifdef INCLUDE_I2C_CMDS
-        case I2C_CMD_TYPE:
-            return parseI2CMessage(size, msg, context);
-            break;
+#define I2C_PARSER      parseI2CMessage
+#else
+#define I2C_PARSER      NULL
 #endif
 #ifdef INCLUDE_ONEW_CMDS
-        case ONEW_CMD_TYPE:
-            return parseOneWireMessage(size, msg, context);
-            break;
+#define ONEW_PARSER     parseOneWireMessage
+#else
+#define ONEW_PARSER     NULL
 #endif
 #ifdef INCLUDE_SRVO_CMDS
-        case SRVO_CMD_TYPE:
-            return parseServoMessage(size, msg, context);
-            break;
+#define SRVO_PARSER     parseServoMessage
+#else
+#define SRVO_PARSER     NULL
 #endif
 #ifdef INCLUDE_STEP_CMDS
-        case STEP_CMD_TYPE:
-            return parseStepperMessage(size, msg, context);
-            break;
+#define STEP_PARSER     parseStepperMessage
+#else
+#define STEP_PARSER     NULL
 #endif
 #ifdef INCLUDE_SCHED_CMDS
-        case SCHED_CMD_TYPE:
-            return parseSchedulerMessage(size, msg, context);
-            break;
+#define SCHED_PARSER    parseSchedulerMessage
+#define SCHED_EXT_PARSER parseSchedulerExtMessage
+#else
+#define SCHED_PARSER    NULL
+#define SCHED_EXT_PARSER NULL
 #endif
 #ifdef INCLUDE_SERIAL_CMDS
-        case SER_CMD_TYPE:
-            return parseSerialMessage(size, msg, context);
-            break;
+#define SER_PARSER      parseSerialMessage
+#else
+#define SER_PARSER      NULL
 #endif
-        case REF_CMD_TYPE:
-            return parseRefMessage(size, msg, context);
-            break;
-        case EXPR_CMD_TYPE:
-            return parseExprMessage(size, msg, context);
-            break;
+
+static const MessageHandler messageParsers[] PROGMEM =
+    {
+    NULL,                       // 0x00
+    parseBoardControlMessage,   // BC_CMD_TYPE
+    parseBoardStatusMessage,    // BS_CMD_TYPE
+    DIG_PARSER,                 // DIG_CMD_TYPE
+    ALG_PARSER,                 // ALG_CMD_TYPE
+    I2C_PARSER,                 // I2C_CMD_TYPE
+    ONEW_PARSER,                // ONEW_CMD_TYPE
+    SCHED_EXT_PARSER,           // SCHED_EXT_CMD_TYPE
+    SRVO_PARSER,                // SRVO_CMD_TYPE
+    STEP_PARSER,                // STEP_CMD_TYPE
+    SCHED_PARSER,               // SCHED_CMD_TYPE
+    NULL,                       // SCHED_RESP_TYPE
+    parseRefMessage,            // REF_CMD_TYPE
+    parseExprMessage,           // EXPR_CMD_TYPE
+    SER_PARSER,                 // SER_CMD_TYPE
+    NULL                        // SEQ_FRAME
+    };
+
+bool parseMessage(int size, const byte *msg, CONTEXT *context)
+    {
+    MessageHandler parser = (MessageHandler) 
+        pgm_read_ptr(&messageParsers[msg[0] >> 4]);
+
+#ifdef INCLUDE_PROTOCOL_STATS
+    uint32_t start;
+    bool rescheduled;
+#endif
+
+    if (parser == NULL)
+        {
+        return false;
         }
+#ifdef INCLUDE_PROTOCOL_STATS
+    start = micros();
+    rescheduled = parser(size, msg, context);
+    recordLatency(msg[0] >> 4, micros() - start);
+    return rescheduled;
+#else
+    return parser(size, msg, context);
+#endif
+    }
+
+bool dispatchMessage(const MessageHandler *table, byte tableSize,
+                     int size, const byte *msg, CONTEXT *context)
+    {
+    byte subtype = msg[0] & CMD_SUBTYPE_MASK;
+    MessageHandler handler;
+
+    if (subtype >= tableSize)
+        {
         return false;
+        }
+    handler = (MessageHandler) pgm_read_ptr(&table[subtype]);
+    if (handler == NULL)
+        {
+        return false;
+        }
+    return handler(size, msg, context);
     }
 
 static void processChar(byte c)
     {
-    if (c == HDLC_FRAME_FLAG) 
+    if (c == HDLC_FRAME_FLAG && rxFrameLen != 0 && rxFirst == STREAM_FRAME)
         {
-        if (messageCount > 1)
+        endStreamFrame();
+        rxFrameLen = 0;
+        rxCrc = SEQ_CRC_INIT;
+        rxEscape = false;
+        rxDiscard = false;
+        }
+    else if (c == HDLC_FRAME_FLAG) 
+        {
+        bool valid;
+        uint16_t size;
+
+        // A valid plain frame has at least one data byte plus the checksum,
+        // and the checksum is the sum of all of the bytes before it.  A 
+        // valid sequenced frame has the header, sequence number and at 
+        // least one data byte, and its CRC (including the CRC bytes) is 0.
+        if (rxFirst == SEQ_FRAME)
             {
-            byte checksum = 0;
-            byte *msg = inputData;
-            for (int i=0;i<messageCount-1;i++)
+            valid = rxFrameLen > SEQ_CRC_SIZE + 2 && rxCrc == 0;
+            size = rxFrameLen - SEQ_CRC_SIZE;
+            }
+        else
+            {
+            valid = rxFrameLen > 1 && (byte) (rxChecksum - rxLast) == rxLast;
+            size = rxFrameLen - 1;
+            }
+
+        if (!rxDiscard && valid && size <= MESSAGE_MAX_SIZE)
+            {
+            rxBuffer[rxFrameStart & RX_BUFFER_MASK] = size & 0xFF;
+            rxBuffer[(rxFrameStart + 1) & RX_BUFFER_MASK] = size >> 8;
+            // Drop the check bytes from the stored frame
+            rxHead -= rxFrameLen - size;
+            rxFrameCount++;
+            baudHeard = true;
+            STATS_COUNT(framesReceived);
+            }
+        else
+            {
+            rxHead = rxFrameStart;
+            if (!rxDiscard && !valid && rxFrameLen != 0)
                 {
-                checksum += *msg++;
+                STATS_COUNT(checksumErrors);
                 }
-            if (checksum == *msg)
+            else if (!rxDiscard && valid)
                 {
-                parseMessage(messageCount-1, inputData, schedulerDefaultContext());
+                STATS_COUNT(overruns);
                 }
             }
-        processingEscapeState = 0;
-        messageCount = 0;
+        rxFrameStart = rxHead;
+        rxFrameLen = 0;
+        rxChecksum = 0;
+        rxCrc = SEQ_CRC_INIT;
+        rxEscape = false;
+        rxDiscard = false;
         } 
     else if (c == HDLC_ESCAPE) 
         {
-        processingEscapeState = 1;
+        rxEscape = true;
+        STATS_COUNT(escapeBytes);
         } 
-    else if (processingEscapeState) 
+    else if (!rxDiscard)
         {
-        processingEscapeState = 0;
-        inputData[messageCount++] = c ^ HDLC_MASK;
+        if (rxEscape)
+            {
+            rxEscape = false;
+            c ^= HDLC_MASK;
+            }
+        if (rxFrameLen == 0)
+            {
+            rxFirst = c;
+            if (rxFirst != STREAM_FRAME)
+                {
+                // Reserve space for the length header of the new frame
+                rxHead += RX_HEADER_SIZE;
+                }
+            }
+        if (rxFirst == STREAM_FRAME)
+            {
+            streamChar(c);
+            rxFrameLen++;
+            rxCrc = crc16Update(rxCrc, c);
+            return;
+            }
+        if (rxFrameLen >= RX_FRAME_MAX ||
+            (uint16_t) (rxHead - rxTail) >= RX_BUFFER_SIZE)
+            {
+            // Frame is too large for the message buffer, or the ring
+            // buffer is full, so drop the frame up to the next flag.
+            rxDiscard = true;
+            rxHead = rxFrameStart;
+            STATS_COUNT(overruns);
+            return;
+            }
+        rxBuffer[rxHead++ & RX_BUFFER_MASK] = c;
+        rxFrameLen++;
+        rxChecksum += c;
+        rxLast = c;
+        if (rxFirst == SEQ_FRAME)
+            {
+            rxCrc = crc16Update(rxCrc, c);
+            }
+        }
+    }
+
+static void streamChar(byte c)
+    {
+    uint16_t room;
+    TASK *task = schedulerStreamTask(&room);
+
+    if (task == NULL)
+        {
+        rxDiscard = true;
+        }
+    else if (rxFrameLen == 1)
+        {
+        byte ahead = c - streamExpected;
+
+        if (ahead != 0)
+            {
+            // A frame from beyond a gap is naked once per gap, and a 
+            // retransmitted frame which was already written is acked.
+            if (ahead <= STREAM_WINDOW_SIZE)
+                {
+                streamNakPending = !streamNakSent;
+                streamNakSent = true;
+                }
+            else
+                {
+                streamAckPending = true;
+                }
+            rxDiscard = true;
+            }
+        }
+    else if (rxFrameLen >= 2)
+        {
+        if (rxFrameLen >= SEQ_CRC_SIZE + 2)
+            {
+            // Release the byte held back two bytes ago
+            uint16_t pos = rxFrameLen - SEQ_CRC_SIZE - 2;
+
+            if (pos >= room)
+                {
+                rxDiscard = true;
+                STATS_COUNT(overruns);
+                return;
+                }
+            task->data[task->currLen + pos] = streamHold[rxFrameLen & 1];
+            }
+        streamHold[rxFrameLen & 1] = c;
+        }
+    }
+
+static void endStreamFrame()
+    {
+    uint16_t room;
+    TASK *task = schedulerStreamTask(&room);
+
+    if (rxDiscard || task == NULL)
+        {
+        return;
+        }
+    if (rxFrameLen > SEQ_CRC_SIZE + 2 && rxCrc == 0)
+        {
+        uint16_t size = rxFrameLen - SEQ_CRC_SIZE - 2;
+
+        task->currLen += size;
+        streamExpected++;
+        streamNakSent = false;
+        streamAckPending = true;
+        streamDone = (size == room);
+        STATS_COUNT(framesReceived);
         }
     else
         {
-        inputData[messageCount++] = c;
+        STATS_COUNT(checksumErrors);
         }
     }
 
-void handleInput()
+void openTaskStream()
+    {
+    uint16_t room;
+
+    streamExpected = 0;
+    streamNakPending = false;
+    streamNakSent = false;
+    // The opening ack has the sequence number before the first frame
+    streamAckPending = true;
+    streamDone = (schedulerStreamTask(&room) != NULL && room == 0);
+    }
+
+static void sendStreamReply(byte replyType)
+    {
+    byte reply[2];
+
+    reply[0] = streamExpected - 1;
+    reply[1] = STREAM_WINDOW_SIZE;
+    sendReplyFrame(sizeof(reply), replyType, reply);
+    streamAckPending = false;
+    streamNakPending = false;
+    }
+
+static void drainInput()
     {
-    int input = Serial.read();
-    if (input != -1) 
+    int input;
+
+    for (byte n = 0; n < RX_DRAIN_MAX && (input = Serial.read()) != -1; n++)
         {
         processChar((byte) input);
-        }  
+        }
+    }
+
+static void reverseBytes(byte *data, uint16_t n)
+    {
+    byte *last = &data[n];
+
+    while (data + 1 < last)
+        {
+        byte c = *data;
+
+        *data++ = *--last;
+        *last = c;
+        }
     }
 
+// Rotate the ring so the frame at rxTail starts at the beginning of the 
+// buffer, which leaves it contiguous without a copy.  The ring is only 
+// written by processChar(), so the positions can be moved with it.
+static void rotateRxBuffer()
+    {
+    uint16_t shift = rxTail & RX_BUFFER_MASK;
+
+    reverseBytes(rxBuffer, shift);
+    reverseBytes(&rxBuffer[shift], RX_BUFFER_SIZE - shift);
+    reverseBytes(rxBuffer, RX_BUFFER_SIZE);
+    rxTail -= shift;
+    rxHead -= shift;
+    rxFrameStart -= shift;
+    }
+
+static void dispatchFrame()
+    {
+    uint16_t size = rxBuffer[rxTail & RX_BUFFER_MASK] |
+                    rxBuffer[(rxTail + 1) & RX_BUFFER_MASK] << 8;
+    uint16_t offset = (rxTail + RX_HEADER_SIZE) & RX_BUFFER_MASK;
+    const byte *msg;
+
+    if (offset < RX_HEADER_SIZE || offset + size > RX_BUFFER_SIZE)
+        {
+        // Frame wraps around the end of the ring, so linearize it
+        rotateRxBuffer();
+        offset = RX_HEADER_SIZE;
+        }
+    // Frame is contiguous in the ring, so parse it in place
+    msg = &rxBuffer[offset];
+
+    if (msg[0] != SEQ_FRAME)
+        {
+        parseMessage(size, msg, schedulerDefaultContext());
+        }
+    else 
+        {
+        byte ahead = msg[1] - seqExpected;
+
+        if (ahead == 0)
+            {
+            seqExpected++;
+            seqNakSent = false;
+            seqAckPending = true;
+            parseMessage(size - 2, &msg[2], schedulerDefaultContext());
+            }
+        else if (ahead <= SEQ_WINDOW_SIZE)
+            {
+            // A frame has been lost, only nak once per gap.  Frames are
+            // not kept out of order, so the host resends every frame 
+            // after the last one executed.
+            if (!seqNakSent)
+                {
+                sendSeqReply(SEQ_RESP_NAK);
+                seqNakSent = true;
+                }
+            }
+        else
+            {
+            // A retransmitted frame which was already executed
+            seqAckPending = true;
+            }
+        }
+
+    rxTail += RX_HEADER_SIZE + size;
+    rxFrameCount--;
+    }
+
+static void sendSeqReply(byte replyType)
+    {
+    byte reply[2];
+
+    // Both acks and naks acknowledge every frame up to the last executed
+    reply[0] = seqExpected - 1;
+    reply[1] = SEQ_WINDOW_SIZE;
+    sendReplyFrame(sizeof(reply), replyType, reply);
+    seqAckPending = false;
+    }
+
+void handleInput()
+    {
+    byte frames;
+
+    drainInput();
+
+    // Only dispatch the frames which were complete on entry, so that a 
+    // sustained command stream can not starve the scheduler.  Input is
+    // drained between frames so the UART buffer does not overrun while
+    // commands execute, and subscribed pins are sampled between frames so
+    // a stream of commands does not hold up their samples.
+    frames = rxFrameCount;
+    while (frames--)
+        {
+        dispatchFrame();
+        drainInput();
+#ifdef INCLUDE_DIG_CMDS
+        sampleSubscriptions();
+#endif
+        }
+
+    // One cumulative ack covers all of the sequenced frames in the batch
+    if (seqAckPending)
+        {
+        sendSeqReply(SEQ_RESP_ACK);
+        }
+
+    // Likewise for stream frames, and the stream ends once the whole of
+    // the task has been written.
+    if (streamNakPending)
+        {
+        sendStreamReply(STREAM_RESP_NAK);
+        }
+    else if (streamAckPending)
+        {
+        sendStreamReply(STREAM_RESP_ACK);
+        }
+    if (streamDone)
+        {
+        byte status = schedulerEndStream();
+
+        streamDone = false;
+        sendReplyFrame(sizeof(status), STREAM_RESP_END, &status);
+        }
+
+    if (baudConfirming)
+        {
+        confirmBaudRate();
+        }
+    else if (baudPending != baudCurrent)
+        {
+        changeBaudRate();
+        }
+    }
+
+// Reply frames are escaped and checksummed into a transmit ring as they
+// are built, and handed to the UART in bulk writes of as many bytes as its
+// transmit buffer has room for.  Anything that does not fit is left in the
+// ring and written by later calls to handleOutput(), so a full UART does
+// not stall the interpreter unless the ring itself fills up.
+#define TX_BUFFER_MASK      (TX_BUFFER_SIZE - 1)
+
+static byte txBuffer[TX_BUFFER_SIZE];
+static uint16_t txHead = 0;
+static uint16_t txTail = 0;
 static byte outgoingChecksum;
 
+static void stageByte(byte c);
+
+static void stageByte(byte c)
+    {
+    // Only wait on the UART when there is no room left to stage into
+    while ((uint16_t) (txHead - txTail) >= TX_BUFFER_SIZE)
+        {
+        handleOutput();
+        }
+    txBuffer[txHead++ & TX_BUFFER_MASK] = c;
+    }
+
+void handleOutput()
+    {
+    uint16_t pending = txHead - txTail;
+    uint16_t offset, count;
+    int room;
+
+    while (pending != 0 && (room = Serial.availableForWrite()) > 0)
+        {
+        offset = txTail & TX_BUFFER_MASK;
+        count = TX_BUFFER_SIZE - offset;
+        if (count > pending)
+            count = pending;
+        if (count > (uint16_t) room)
+            count = room;
+        Serial.write(&txBuffer[offset], count);
+        txTail += count;
+#ifdef INCLUDE_PROTOCOL_STATS
+        protocolStats.bytesSent += count;
+#endif
+        pending -= count;
+        }
+    }
+
 void startReplyFrame(byte replyType)
     {
-    Serial.write(replyType);
-    outgoingChecksum = replyType;
+    outgoingChecksum = 0;
+    sendReplyByte(replyType);
     }
 
 void endReplyFrame()
     {
     sendReplyByte(outgoingChecksum);
-    Serial.write(HDLC_FRAME_FLAG);
+    stageByte(HDLC_FRAME_FLAG);
+    handleOutput();
     }
 
 void sendReplyByte(byte replyByte)
@@ -152,34 +684,94 @@ void sendReplyByte(byte replyByte)
     if (replyByte == HDLC_FRAME_FLAG || 
         replyByte == HDLC_ESCAPE) 
         {
-        Serial.write(HDLC_ESCAPE);
-        Serial.write(replyByte ^ HDLC_MASK);
+        stageByte(HDLC_ESCAPE);
+        stageByte(replyByte ^ HDLC_MASK);
         }
     else
         {
-        Serial.write(replyByte);
+        stageByte(replyByte);
         }
     outgoingChecksum += replyByte;
     }
 
-void sendReply(int count, byte replyType, const byte *reply, 
-               CONTEXT *context, byte bind)
+// Replies to procedures in a batch frame are coalesced into a single
+// BC_RESP_BATCH frame, with each reply preceded by its length.  The
+// coalesced frame is sent at the end of the outermost batch, or earlier
+// if the next reply will not fit.
+static byte replyBatch[REPLY_BATCH_SIZE];
+static int replyBatchLen = 0;
+static byte replyBatchCount = 0;
+static byte replyBatchDepth = 0;
+
+static void sendReplyFrame(int count, byte replyType, const byte *reply)
     {
     const byte *nextChar = reply;
     int i;
 
+    startReplyFrame(replyType);
+    for (i=0; i < count; i++) 
+        {
+        sendReplyByte(*nextChar++);
+        }
+    endReplyFrame();
+    }
+
+static void flushReplyBatch()
+    {
+    if (replyBatchCount == 1)
+        {
+        // A lone reply is sent in its usual frame
+        sendReplyFrame(replyBatchLen - 2, replyBatch[1], &replyBatch[2]);
+        }
+    else if (replyBatchCount > 1)
+        {
+        sendReplyFrame(replyBatchLen, BC_RESP_BATCH, replyBatch);
+        }
+    replyBatchLen = 0;
+    replyBatchCount = 0;
+    }
+
+void startReplyBatch()
+    {
+    replyBatchDepth++;
+    }
+
+void endReplyBatch()
+    {
+    if (--replyBatchDepth == 0)
+        {
+        flushReplyBatch();
+        }
+    }
+
+void sendReply(int count, byte replyType, const byte *reply, 
+               CONTEXT *context, byte bind)
+    {
     if ((replyType != BS_RESP_STRING) && (context->currBlockLevel >= 0))
         {
         memcpy(&context->bind[bind * BIND_SPACING], reply, count);
         }
+    else if ((replyType != BS_RESP_STRING) && (replyBatchDepth > 0) &&
+             (count + 2 <= REPLY_BATCH_SIZE))
+        {
+        if (replyBatchLen + count + 2 > REPLY_BATCH_SIZE)
+            {
+            flushReplyBatch();
+            }
+        replyBatch[replyBatchLen++] = count + 1;
+        replyBatch[replyBatchLen++] = replyType;
+        memcpy(&replyBatch[replyBatchLen], reply, count);
+        replyBatchLen += count;
+        replyBatchCount++;
+        }
     else
         {
-        startReplyFrame(replyType);
-        for (i=0; i < count; i++) 
+        // Keep replies in order if this one is too large to coalesce
+        if (replyType != BS_RESP_STRING)
             {
-            sendReplyByte(*nextChar++);
+            flushReplyBatch();
             }
-        endReplyFrame();
+        sendReplyFrame(count, replyType, reply);
         }
     }
 
@@ -193,3 +785,88 @@ void sendStringf(const char *fmt, ...)
     va_end(argp);
     sendReply(strlen(buffer), BS_RESP_STRING, (const byte *) buffer, NULL, 0);
     }
+
+static void discardFrame()
+    {
+    rxHead = rxFrameStart;
+    rxFrameLen = 0;
+    rxChecksum = 0;
+    rxCrc = SEQ_CRC_INIT;
+    rxEscape = false;
+    rxDiscard = false;
+    }
+
+bool requestBaudRate(byte rate)
+    {
+    if (rate >= NUM_BAUD_RATES || baudConfirming)
+        {
+        return false;
+        }
+    // The change is made once the reply has been sent at the old rate
+    baudPending = rate;
+    return true;
+    }
+
+static void changeBaudRate()
+    {
+    while (txHead != txTail)
+        {
+        handleOutput();
+        }
+    Serial.flush();
+    Serial.end();
+    Serial.begin(baudRates[baudPending]);
+    discardFrame();
+    baudHeard = false;
+    baudConfirming = true;
+    baudSwitchMillis = millis();
+    }
+
+static void confirmBaudRate()
+    {
+    if (baudHeard)
+        {
+        baudCurrent = baudPending;
+        baudConfirming = false;
+        }
+    else if (millis() - baudSwitchMillis >= BAUD_CONFIRM_MILLIS)
+        {
+        Serial.end();
+        Serial.begin(baudRates[baudCurrent]);
+        discardFrame();
+        baudPending = baudCurrent;
+        baudConfirming = false;
+        }
+    }
+
+#ifdef INCLUDE_PROTOCOL_STATS
+static void recordLatency(byte cmdType, uint32_t elapsed)
+    {
+    byte bin = 0;
+    uint16_t *count;
+
+    elapsed >>= STATS_HIST_SHIFT;
+    while (elapsed != 0 && bin < STATS_HIST_BINS - 1)
+        {
+        elapsed >>= 1;
+        bin++;
+        }
+
+    // Saturate rather than wrap, so a busy bin still reads as busy
+    count = &protocolStats.latency[cmdType][bin];
+    if (*count != 0xFFFF)
+        {
+        (*count)++;
+        }
+    }
+
+const PROTOCOL_STATS *getProtocolStats()
+    {
+    return &protocolStats;
+    }
+
+void resetProtocolStats()
+    {
+    memset(&protocolStats, 0, sizeof(protocolStats));
+    }
+#endif
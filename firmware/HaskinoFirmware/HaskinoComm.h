@@ -7,16 +7,50 @@
 #define HDLC_ESCAPE      0x7D
 #define HDLC_MASK        0x20
 
+// Commands are dispatched through flash resident tables of handlers,
+// indexed by command type, and then by command subtype.
+typedef bool (*MessageHandler)(int size, const byte *msg, CONTEXT *context);
+
+#define DISPATCH_SIZE(table)    (sizeof(table) / sizeof(table[0]))
+
+// Protocol counters, and histograms of the time taken by parseMessage()
+// for each command type.  Histogram bin n counts times under 
+// 2^(STATS_HIST_SHIFT+n) microseconds, and the last bin counts the rest.
+// The structure is sent as is in the BS_RESP_STATS reply.
+#define STATS_CMD_TYPES         16
+
+typedef struct protocol_stats_t
+    {
+    uint32_t            framesReceived;
+    uint32_t            checksumErrors;
+    uint32_t            escapeBytes;
+    uint32_t            overruns;
+    uint32_t            bytesSent;
+    uint16_t            latency[STATS_CMD_TYPES][STATS_HIST_BINS];
+    } PROTOCOL_STATS;
+
 int  processingMessage();
 void handleInput();
+void handleOutput();
+bool requestBaudRate(byte rate);
 void startReplyFrame(byte replyType);
 void endReplyFrame();
 void sendReplyByte(byte replyByte);
+void startReplyBatch();
+void endReplyBatch();
 void sendReply(int count, byte replyType, const byte *reply, 
                CONTEXT *context, byte bind);
 void sendTypeReply(int type, const byte *src, byte *replyBuff, 
                    byte replyType, CONTEXT *context, byte bind);
 void sendStringf(const char *fmt, ...);
+#ifdef INCLUDE_PROTOCOL_STATS
+const PROTOCOL_STATS *getProtocolStats();
+void resetProtocolStats();
+#endif
 bool parseMessage(int size, const byte *msg, CONTEXT *context);
+uint16_t crc16Update(uint16_t crc, byte c);
+void openTaskStream();
+bool dispatchMessage(const MessageHandler *table, byte tableSize,
+                     int size, const byte *msg, CONTEXT *context);
 
 #endif /* HaskinoCommH */
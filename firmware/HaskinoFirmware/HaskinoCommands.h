@@ -18,11 +18,15 @@
 #define BC_CMD_DELAY_MICROS     (BC_CMD_TYPE | 0x3)
 #define BC_CMD_ITERATE          (BC_CMD_TYPE | 0x4)
 #define BC_CMD_IF_THEN_ELSE     (BC_CMD_TYPE | 0x5)
+#define BC_CMD_BATCH            (BC_CMD_TYPE | 0x6)
+#define BC_CMD_SET_BAUD         (BC_CMD_TYPE | 0x7)
 
 // Board Control responses
 #define BC_RESP_DELAY           (BC_CMD_TYPE | 0x8)
 #define BC_RESP_IF_THEN_ELSE    (BC_CMD_TYPE | 0x9)
 #define BC_RESP_ITERATE         (BC_CMD_TYPE | 0xA)
+#define BC_RESP_BATCH           (BC_CMD_TYPE | 0xB)
+#define BC_RESP_SET_BAUD        (BC_CMD_TYPE | 0xC)
 
 // Board Status commands
 #define BS_CMD_TYPE             0x20
@@ -31,6 +35,8 @@
 #define BS_CMD_REQUEST_MICROS   (BS_CMD_TYPE | 0x2)
 #define BS_CMD_REQUEST_MILLIS   (BS_CMD_TYPE | 0x3)
 #define BS_CMD_DEBUG            (BS_CMD_TYPE | 0x4)
+#define BS_CMD_STATS            (BS_CMD_TYPE | 0x5)
+#define BS_CMD_ARENA_STATS      (BS_CMD_TYPE | 0x6)
 
 // Board Status responses
 #define BS_RESP_VERSION         (BS_CMD_TYPE | 0x8)
@@ -39,6 +45,8 @@
 #define BS_RESP_MILLIS          (BS_CMD_TYPE | 0xB)
 #define BS_RESP_STRING          (BS_CMD_TYPE | 0xC)
 #define BS_RESP_DEBUG           (BS_CMD_TYPE | 0xD)
+#define BS_RESP_STATS           (BS_CMD_TYPE | 0xE)
+#define BS_RESP_ARENA_STATS     (BS_CMD_TYPE | 0xF)
 
 // Digital commands
 #define DIG_CMD_TYPE            0x30
@@ -46,10 +54,14 @@
 #define DIG_CMD_WRITE_PIN       (DIG_CMD_TYPE | 0x1)
 #define DIG_CMD_READ_PORT       (DIG_CMD_TYPE | 0x2)
 #define DIG_CMD_WRITE_PORT      (DIG_CMD_TYPE | 0x3)
+#define DIG_CMD_SUBSCRIBE       (DIG_CMD_TYPE | 0x4)
+#define DIG_CMD_UNSUBSCRIBE     (DIG_CMD_TYPE | 0x5)
+#define DIG_CMD_SAMPLING        (DIG_CMD_TYPE | 0x6)
 
 // Digital responses
 #define DIG_RESP_READ_PIN       (DIG_CMD_TYPE | 0x8)
 #define DIG_RESP_READ_PORT      (DIG_CMD_TYPE | 0x9)
+#define DIG_RESP_SAMPLES        (DIG_CMD_TYPE | 0xA)
 
 // Analog commands
 #define ALG_CMD_TYPE            0x40
@@ -117,12 +129,33 @@
 #define SCHED_CMD_DETACH_INT    (SCHED_CMD_TYPE | 0xB)
 #define SCHED_CMD_INTERRUPTS    (SCHED_CMD_TYPE | 0xC)
 #define SCHED_CMD_NOINTERRUPTS  (SCHED_CMD_TYPE | 0xD)
+#define SCHED_CMD_PERIODIC      (SCHED_CMD_TYPE | 0xE)
+#define SCHED_CMD_OVERRUNS      (SCHED_CMD_TYPE | 0xF)
 
 // Scheduler responses
 #define SCHED_RESP_TYPE          0xB0
 #define SCHED_RESP_QUERY        (SCHED_RESP_TYPE | 0x0)
 #define SCHED_RESP_QUERY_ALL    (SCHED_RESP_TYPE | 0x1)
 #define SCHED_RESP_BOOT_TASK    (SCHED_RESP_TYPE | 0x2)
+#define SCHED_RESP_OVERRUNS     (SCHED_RESP_TYPE | 0x3)
+
+// Scheduler commands which do not fit in SCHED_CMD_TYPE, in the unused
+// 0x70 type
+#define SCHED_EXT_CMD_TYPE      0x70
+#define SCHED_CMD_TAKE_SEM_TIMED (SCHED_EXT_CMD_TYPE | 0x0)
+#define SCHED_CMD_QUERY_SEM     (SCHED_EXT_CMD_TYPE | 0x1)
+#define SCHED_CMD_QUEUE_CREATE  (SCHED_EXT_CMD_TYPE | 0x2)
+#define SCHED_CMD_QUEUE_SEND    (SCHED_EXT_CMD_TYPE | 0x3)
+#define SCHED_CMD_QUEUE_RECV    (SCHED_EXT_CMD_TYPE | 0x4)
+#define SCHED_CMD_STREAM_TASK   (SCHED_EXT_CMD_TYPE | 0x5)
+#define SCHED_CMD_TASK_BUDGET   (SCHED_EXT_CMD_TYPE | 0x6)
+#define SCHED_CMD_SWAP_TASK     (SCHED_EXT_CMD_TYPE | 0x7)
+
+// Extended scheduler responses
+#define SCHED_RESP_TAKE_SEM     (SCHED_EXT_CMD_TYPE | 0x8)
+#define SCHED_RESP_QUERY_SEM    (SCHED_EXT_CMD_TYPE | 0x9)
+#define SCHED_RESP_QUEUE_SEND   (SCHED_EXT_CMD_TYPE | 0xA)
+#define SCHED_RESP_QUEUE_RECV   (SCHED_EXT_CMD_TYPE | 0xB)
 
 // Reference commands
 #define REF_CMD_TYPE            0xC0
@@ -159,5 +192,25 @@
 #define SER_RESP_READ           (SER_CMD_TYPE | 0x9)
 #define SER_RESP_READ_LIST      (SER_CMD_TYPE | 0xA)
 
+// Sequenced frame header, followed by a sequence number, a command, and 
+// a two byte CRC (high byte first) in place of the checksum.
+#define SEQ_FRAME               0xF0
+#define SEQ_CRC_SIZE            2
+#define SEQ_CRC_INIT            0xFFFF
+
+// Sequenced frame responses
+#define SEQ_RESP_ACK            (SEQ_FRAME | 0x8)
+#define SEQ_RESP_NAK            (SEQ_FRAME | 0x9)
+
+// Streamed task frame header, followed by a sequence number, task code to
+// be appended to the task being streamed, and a two byte CRC.  Stream 
+// frames are written straight into the task, and never dispatched.
+#define STREAM_FRAME            0xF1
+
+// Streamed task responses
+#define STREAM_RESP_ACK         (SEQ_FRAME | 0xA)
+#define STREAM_RESP_NAK         (SEQ_FRAME | 0xB)
+#define STREAM_RESP_END         (SEQ_FRAME | 0xC)
+
 #endif /* HaskinoCommandsH */
 
@@ -1,13 +1,41 @@
 #ifndef HaskinoConfigH
 #define HaskinoConfigH
 
+#include <avr/io.h>
+
 #define MESSAGE_MAX_SIZE    256
+#define SEQ_WINDOW_SIZE     4
+#define STREAM_WINDOW_SIZE  4
+#define BAUD_CONFIRM_MILLIS 1000
 #define MAX_REFS            32
 #define BIND_SPACING        6
 #define DEFAULT_BIND_COUNT  10
 #define MAX_BLOCK_LEVELS    5
+#define CODE_STAGE_SIZE     64      // Bytes of a flash task command in SRAM
 #define NUM_SEMAPHORES      5
+#define NUM_QUEUES          4
 #define MAX_INTERRUPTS      6 
+#define ISR_EVENT_QUEUE_SIZE 8      // Must be a power of 2
+#define STATS_HIST_BINS     8
+#define STATS_HIST_SHIFT    6       // First bin holds times under 64us
+#define IDLE_SLEEP_MIN_MILLIS 2     // Shortest idle time worth sleeping for
+
+// Boards with more than 4K of SRAM, such as the Mega, get larger buffers.
+#if RAMEND > 0x1000
+#define RX_BUFFER_SIZE      512     // Must be a power of 2
+#define TX_BUFFER_SIZE      256     // Must be a power of 2
+#define REPLY_BATCH_SIZE    64
+#define TASK_TABLE_SIZE     256     // Must be a power of 2, 256 for one per id
+#define TASK_ARENA_SIZE     3072    // Bytes for task code and binds
+#define MAX_SUBSCRIPTIONS   8
+#else
+#define RX_BUFFER_SIZE      256     // Holds one largest frame
+#define TX_BUFFER_SIZE      64      // Must be a power of 2
+#define REPLY_BATCH_SIZE    32
+#define TASK_TABLE_SIZE     16      // Must be a power of 2, 256 for one per id
+#define TASK_ARENA_SIZE     512     // Bytes for task code and binds
+#define MAX_SUBSCRIPTIONS   4
+#endif
 
 #define MAX_FIRM_SERVOS     4
 #define MAX_FIRM_STEPPERS   4
@@ -21,6 +49,24 @@
 #undef  INCLUDE_SPI_CMDS
 #define INCLUDE_SCHED_CMDS
 #undef  INCLUDE_SERIAL_CMDS
+#if RAMEND > 0x1000              // Too large for boards with 4K of SRAM or less
+#define INCLUDE_PROTOCOL_STATS
+#else
+#undef  INCLUDE_PROTOCOL_STATS
+#endif
+#if RAMEND > 0x1000              // Too large for boards with 4K of SRAM or less
+#define INCLUDE_TASK_STATS
+#else
+#undef  INCLUDE_TASK_STATS
+#endif
+#if RAMEND > 0x1000              // Adds 8 bytes to every task
+#define INCLUDE_TASK_BUDGET
+#else
+#undef  INCLUDE_TASK_BUDGET
+#endif
+#undef  INCLUDE_IDLE_SLEEP      // Sleep between timer ticks when idle
+#define BOOT_IMAGE_COMPRESS     // Run length encode boot task bodies
+#undef  BOOT_IMAGE_FLASH        // Run boot tasks in place from HaskinoBootImage.h
 
 //#define DEBUG
 #endif /* HaskinoConfigH */
@@ -10,25 +10,25 @@ static bool handleReadPin(int size, const byte *msg, CONTEXT *context);
 static bool handleWritePin(int size, const byte *msg, CONTEXT *context);
 static bool handleReadPort(int size, const byte *msg, CONTEXT *context);
 static bool handleWritePort(int size, const byte *msg, CONTEXT *context);
+static bool handleSubscribe(int size, const byte *msg, CONTEXT *context);
+static bool handleUnsubscribe(int size, const byte *msg, CONTEXT *context);
+static bool handleSampling(int size, const byte *msg, CONTEXT *context);
+
+static const MessageHandler digitalHandlers[] PROGMEM =
+    {
+    handleReadPin,           // DIG_CMD_READ_PIN
+    handleWritePin,          // DIG_CMD_WRITE_PIN
+    handleReadPort,          // DIG_CMD_READ_PORT
+    handleWritePort,         // DIG_CMD_WRITE_PORT
+    handleSubscribe,         // DIG_CMD_SUBSCRIBE
+    handleUnsubscribe,       // DIG_CMD_UNSUBSCRIBE
+    handleSampling,          // DIG_CMD_SAMPLING
+    };
 
 bool parseDigitalMessage(int size, const byte *msg, CONTEXT *context)
     {
-    switch (msg[0]) 
-        {
-        case DIG_CMD_READ_PIN:
-            handleReadPin(size, msg, context);
-            break;
-        case DIG_CMD_WRITE_PIN:
-            handleWritePin(size, msg, context);
-            break;
-        case DIG_CMD_READ_PORT:
-            handleReadPort(size, msg, context);
-            break;
-        case DIG_CMD_WRITE_PORT:
-            handleWritePort(size, msg, context);
-            break;
-        }
-    return false;
+    return dispatchMessage(digitalHandlers, DISPATCH_SIZE(digitalHandlers),
+                           size, msg, context);
     }
 
 static bool handleReadPin(int size, const byte *msg, CONTEXT *context)
@@ -98,4 +98,174 @@ static bool handleWritePort(int size, const byte *msg, CONTEXT *context)
 
     return false;
     }
+
+// Pin sampling subscriptions.  Each active subscription is sampled every
+// period milliseconds, and every decimation samples the rounded mean is
+// pushed to the host.  For a digital pin the rounded mean is the majority
+// value.  All values due in one pass are packed into a single
+// DIG_RESP_SAMPLES frame: the millis() time, followed by a slot byte (with
+// SAMPLE_ANALOG set for analog pins) and a one byte digital or two byte
+// analog value for each subscription.
+#define SAMPLE_ANALOG       0x80
+#define SAMPLE_ALL          0xFF
+
+typedef struct sample_sub_t
+    {
+    bool                active;
+    bool                analog;
+    bool                paused;
+    byte                pin;
+    byte                decimation;
+    byte                count;
+    uint16_t            period;
+    uint32_t            sum;
+    uint32_t            nextMillis;
+    } SAMPLE_SUB;
+
+static SAMPLE_SUB subscriptions[MAX_SUBSCRIPTIONS];
+static byte subscriptionCount = 0;
+
+static bool handleSubscribe(int size, const byte *msg, CONTEXT *context)
+    {
+    byte *expr = (byte *) &msg[1];
+    byte slot = evalWord8Expr(&expr, context);
+    byte pinNo = evalWord8Expr(&expr, context);
+    bool analog = evalBoolExpr(&expr, context);
+    uint16_t period = evalWord16Expr(&expr, context);
+    byte decimation = evalWord8Expr(&expr, context);
+    SAMPLE_SUB *sub;
+
+    if (slot >= MAX_SUBSCRIPTIONS)
+        {
+#ifdef DEBUG
+        sendStringf("hS: %d", slot);
+#endif
+        return false;
+        }
+
+    sub = &subscriptions[slot];
+    if (!sub->active)
+        {
+        subscriptionCount++;
+        }
+    sub->active = true;
+    sub->analog = analog;
+    sub->paused = false;
+    sub->pin = pinNo;
+    sub->decimation = decimation == 0 ? 1 : decimation;
+    sub->count = 0;
+    sub->period = period;
+    sub->sum = 0;
+    sub->nextMillis = millis();
+    return false;
+    }
+
+static bool handleUnsubscribe(int size, const byte *msg, CONTEXT *context)
+    {
+    byte *expr = (byte *) &msg[1];
+    byte slot = evalWord8Expr(&expr, context);
+
+    for (byte i = 0; i < MAX_SUBSCRIPTIONS; i++)
+        {
+        if ((slot == SAMPLE_ALL || slot == i) && subscriptions[i].active)
+            {
+            subscriptions[i].active = false;
+            subscriptionCount--;
+            }
+        }
+    return false;
+    }
+
+static bool handleSampling(int size, const byte *msg, CONTEXT *context)
+    {
+    byte *expr = (byte *) &msg[1];
+    byte slot = evalWord8Expr(&expr, context);
+    bool enable = evalBoolExpr(&expr, context);
+    uint32_t now = millis();
+
+    for (byte i = 0; i < MAX_SUBSCRIPTIONS; i++)
+        {
+        if (slot == SAMPLE_ALL || slot == i)
+            {
+            if (subscriptions[i].paused == !enable)
+                {
+                continue;
+                }
+            // Restart sampling from now when resuming, rather than
+            // catching up with the samples missed while paused.
+            subscriptions[i].paused = !enable;
+            subscriptions[i].count = 0;
+            subscriptions[i].sum = 0;
+            subscriptions[i].nextMillis = now;
+            }
+        }
+    return false;
+    }
+
+void sampleSubscriptions()
+    {
+    uint32_t now;
+    bool started = false;
+    SAMPLE_SUB *sub;
+    uint16_t value;
+
+    if (subscriptionCount == 0)
+        {
+        return;
+        }
+
+    now = millis();
+    for (byte i = 0; i < MAX_SUBSCRIPTIONS; i++)
+        {
+        sub = &subscriptions[i];
+        if (!sub->active || sub->paused || 
+            (int32_t) (now - sub->nextMillis) < 0)
+            {
+            continue;
+            }
+
+        sub->nextMillis += sub->period;
+        // Do not queue up a burst of samples after a long stall
+        if ((int32_t) (now - sub->nextMillis) >= 0)
+            {
+            sub->nextMillis = now + sub->period;
+            }
+
+        sub->sum += sub->analog ? analogRead(sub->pin) : 
+                                  digitalRead(sub->pin);
+        if (++sub->count < sub->decimation)
+            {
+            continue;
+            }
+        value = (sub->sum + sub->decimation / 2) / sub->decimation;
+        sub->count = 0;
+        sub->sum = 0;
+
+        if (!started)
+            {
+            startReplyFrame(DIG_RESP_SAMPLES);
+            sendReplyByte(now & 0xFF);
+            sendReplyByte((now >> 8) & 0xFF);
+            sendReplyByte((now >> 16) & 0xFF);
+            sendReplyByte((now >> 24) & 0xFF);
+            started = true;
+            }
+        if (sub->analog)
+            {
+            sendReplyByte(i | SAMPLE_ANALOG);
+            sendReplyByte(value & 0xFF);
+            sendReplyByte(value >> 8);
+            }
+        else
+            {
+            sendReplyByte(i);
+            sendReplyByte(value);
+            }
+        }
+
+    if (started)
+        {
+        endReplyFrame();
+        }
+    }
 #endif
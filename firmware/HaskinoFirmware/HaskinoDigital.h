@@ -4,5 +4,6 @@
 #include "HaskinoScheduler.h"
 
 bool parseDigitalMessage(int size, const byte *msg, CONTEXT *context);
+void sampleSubscriptions();
 
 #endif /* HaskinoDigitalH */
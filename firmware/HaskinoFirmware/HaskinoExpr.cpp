@@ -6,18 +6,55 @@
 #include "HaskinoRefs.h"
 
 static bool handleExprRet(int size, const byte *msg, CONTEXT *context);
+static uint32_t evalCompactLit(byte **ppExpr);
+static int32_t evalCompactSignedLit(byte **ppExpr);
 
-bool parseExprMessage(int size, const byte *msg, CONTEXT *context)
+static const MessageHandler exprHandlers[] PROGMEM =
+    {
+    handleExprRet,           // EXPR_CMD_RET
+    };
+
+// Compact literals carry either a small value in the op byte itself
+// (EXPR_IMM), or a little-endian base 128 varint after the op byte
+// (EXPR_VLIT).  Signed types zigzag encode the value first, so small
+// negative numbers stay short as well.
+static uint32_t evalCompactLit(byte **ppExpr)
     {
-    byte cmd = msg[0];
+    byte *pExpr = *ppExpr;
+    uint32_t val = 0;
+    byte shift = 0;
+    byte b;
 
-    switch (cmd)
+    if (pExpr[1] != EXPR_VLIT)
         {
-        case EXPR_CMD_RET:
-            handleExprRet(size, msg, context);
-            break;
+        *ppExpr += 2; // Use Type and Cmd bytes
+        return pExpr[1] & EXPR_IMM_MASK;
         }
-    return false;
+
+    pExpr += 2;
+    do
+        {
+        b = *pExpr++;
+        val |= ((uint32_t) (b & 0x7F)) << shift;
+        shift += 7;
+        }
+    while ((b & 0x80) && shift < 35);
+
+    *ppExpr = pExpr; // Use Type, Cmd and Varint bytes
+    return val;
+    }
+
+static int32_t evalCompactSignedLit(byte **ppExpr)
+    {
+    uint32_t val = evalCompactLit(ppExpr);
+
+    return (int32_t) (val >> 1) ^ -((int32_t) (val & 1));
+    }
+
+bool parseExprMessage(int size, const byte *msg, CONTEXT *context)
+    {
+    return dispatchMessage(exprHandlers, DISPATCH_SIZE(exprHandlers),
+                           size, msg, context);
     }
 
 bool evalUnitExpr(byte **ppExpr, CONTEXT *context)
@@ -372,7 +409,7 @@ uint8_t evalWord8Expr(byte **ppExpr, CONTEXT *context)
     {
     byte *pExpr = *ppExpr;
     byte exprType = pExpr[0] & EXPR_TYPE_MASK;
-    byte exprOp = pExpr[1];
+    byte exprOp = EXPR_OP(pExpr[1]);
     uint8_t val = 0;
     uint8_t e1,e2;
     int32_t e2l;
@@ -408,6 +445,10 @@ uint8_t evalWord8Expr(byte **ppExpr, CONTEXT *context)
                     val = pExpr[2];
                     *ppExpr += 2 + sizeof(uint8_t); // Use Type, Cmd and Value bytes
                     break;
+                case EXPR_IMM:
+                case EXPR_VLIT:
+                    val = evalCompactLit(ppExpr);
+                    break;
                 case EXPR_REF:
                     refNum = pExpr[2];
                     val = readRefWord8(refNum);
@@ -568,7 +609,7 @@ error:
 int8_t evalInt8Expr(byte **ppExpr, CONTEXT *context)
     {
     byte *pExpr = *ppExpr;
-    byte exprOp = pExpr[1];
+    byte exprOp = EXPR_OP(pExpr[1]);
     int8_t val = 0;
     int8_t e1,e2,e3;
     int32_t e2l;
@@ -598,6 +639,10 @@ int8_t evalInt8Expr(byte **ppExpr, CONTEXT *context)
             val = pExpr[2];
             *ppExpr += 2 + sizeof(int8_t); // Use Type, Cmd and Value bytes
             break;
+        case EXPR_IMM:
+        case EXPR_VLIT:
+            val = evalCompactSignedLit(ppExpr);
+            break;
         case EXPR_REF:
             refNum = pExpr[1];
             val = readRefInt8(refNum);
@@ -750,7 +795,7 @@ int8_t evalInt8Expr(byte **ppExpr, CONTEXT *context)
 uint16_t evalWord16Expr(byte **ppExpr, CONTEXT *context)
     {
     byte *pExpr = *ppExpr;
-    byte exprOp = pExpr[1];
+    byte exprOp = EXPR_OP(pExpr[1]);
     uint16_t val = 0;
     uint16_t e1,e2;
     uint32_t e2l;
@@ -780,6 +825,10 @@ uint16_t evalWord16Expr(byte **ppExpr, CONTEXT *context)
             memcpy((byte *) &val, &pExpr[2], sizeof(uint16_t));
             *ppExpr += 2 + sizeof(uint16_t); // Use Type, Cmd and Value bytes
             break;
+        case EXPR_IMM:
+        case EXPR_VLIT:
+            val = evalCompactLit(ppExpr);
+            break;
         case EXPR_REF:
             refNum = pExpr[2];
             val = readRefWord16(refNum);
@@ -910,7 +959,7 @@ uint16_t evalWord16Expr(byte **ppExpr, CONTEXT *context)
 int16_t evalInt16Expr(byte **ppExpr, CONTEXT *context)
     {
     byte *pExpr = *ppExpr;
-    byte exprOp = pExpr[1];
+    byte exprOp = EXPR_OP(pExpr[1]);
     int16_t val = 0;
     int16_t e1,e2,e3;
     uint32_t e2l;
@@ -940,6 +989,10 @@ int16_t evalInt16Expr(byte **ppExpr, CONTEXT *context)
             memcpy((byte *) &val, &pExpr[2], sizeof(uint16_t));
             *ppExpr += 2 + sizeof(uint16_t); // Use Type, Cmd and Value bytes
             break;
+        case EXPR_IMM:
+        case EXPR_VLIT:
+            val = evalCompactSignedLit(ppExpr);
+            break;
         case EXPR_REF:
             refNum = pExpr[2];
             val = readRefInt16(refNum);
@@ -1088,7 +1141,7 @@ int16_t evalInt16Expr(byte **ppExpr, CONTEXT *context)
 uint32_t evalWord32Expr(byte **ppExpr, CONTEXT *context)
     {
     byte *pExpr = *ppExpr;
-    byte exprOp = pExpr[1];
+    byte exprOp = EXPR_OP(pExpr[1]);
     uint32_t val = 0;
     uint32_t e1,e2;
     uint32_t e2l;
@@ -1118,6 +1171,10 @@ uint32_t evalWord32Expr(byte **ppExpr, CONTEXT *context)
             memcpy((byte *) &val, &pExpr[2], sizeof(uint32_t));
             *ppExpr += 2 + sizeof(uint32_t); // Use Type, Cmd and Value bytes
             break;
+        case EXPR_IMM:
+        case EXPR_VLIT:
+            val = evalCompactLit(ppExpr);
+            break;
         case EXPR_REF:
             refNum = pExpr[2];
             val = readRefWord32(refNum);
@@ -1249,7 +1306,7 @@ int32_t evalInt32Expr(byte **ppExpr, CONTEXT *context)
     {
     byte *pExpr = *ppExpr;
     byte exprType = pExpr[0] & EXPR_TYPE_MASK;
-    byte exprOp = pExpr[1];
+    byte exprOp = EXPR_OP(pExpr[1]);
     int32_t val = 0;
     int32_t e1,e2,e3;
     uint32_t e2l;
@@ -1285,6 +1342,10 @@ int32_t evalInt32Expr(byte **ppExpr, CONTEXT *context)
                 memcpy((byte *) &val, &pExpr[2], sizeof(uint32_t));
                 *ppExpr += 2 + sizeof(uint32_t); // Use Type, Cmd and Value bytes
                 break;
+            case EXPR_IMM:
+            case EXPR_VLIT:
+                val = evalCompactSignedLit(ppExpr);
+                break;
             case EXPR_REF:
                 refNum = pExpr[2];
                 val = readRefInt32(refNum);
@@ -1512,7 +1573,7 @@ error:
 float evalFloatExpr(byte **ppExpr, CONTEXT *context)
     {
     byte *pExpr = *ppExpr;
-    byte exprOp = pExpr[1];
+    byte exprOp = EXPR_OP(pExpr[1]);
     float val = 0.0;
     float e1,e2;
     bool conditional;
@@ -1541,6 +1602,10 @@ float evalFloatExpr(byte **ppExpr, CONTEXT *context)
             memcpy((byte *) &val, &pExpr[2], sizeof(float));
             *ppExpr += 2 + sizeof(float); // Use Type, Cmd and Value bytes
             break;
+        case EXPR_IMM:
+        case EXPR_VLIT:
+            val = (float) evalCompactSignedLit(ppExpr);
+            break;
         case EXPR_REF:
             refNum = pExpr[2];
             val = readRefFloat(refNum);
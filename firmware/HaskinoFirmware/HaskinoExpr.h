@@ -53,6 +53,13 @@
 #define EXPR_QUOT           0x1B
 #define EXPR_MOD            0x1C
 
+// Compact Literal Ops
+#define EXPR_VLIT           0x30
+#define EXPR_IMM            0xC0
+#define EXPR_IMM_MASK       0x1F
+#define EXPR_OP(op)         ((((op) & ~EXPR_IMM_MASK) == EXPR_IMM) ? \
+                             EXPR_IMM : (op))
+
 // List Expression Ops
 #define EXPRL_ELEM          0x07
 #define EXPRL_LEN           0x08
@@ -4,7 +4,14 @@
 #include "HaskinoComm.h"
 #include "HaskinoCommands.h"
 #include "HaskinoBoardStatus.h"
+#include "HaskinoDigital.h"
 #include "HaskinoScheduler.h"
+#if defined(INCLUDE_IDLE_SLEEP) && defined(__AVR__)
+#include <avr/sleep.h>
+#define IDLE_SLEEP
+
+static void idleSleep();
+#endif
 
 /*
  
@@ -28,16 +35,42 @@ void setup()
  *============================================================================*/
 void loop()
 {
-    while (Serial.available()) 
-        {
-        handleInput();
-        if (!processingMessage()) 
-            {
-            schedulerRunTasks();
-            }
-        }
-    if (!processingMessage()) 
+    handleInput();
+    schedulerRunTasks();
+#ifdef INCLUDE_DIG_CMDS
+    sampleSubscriptions();
+#endif
+    handleOutput();
+#ifdef IDLE_SLEEP
+    idleSleep();
+#endif
+}
+
+#ifdef IDLE_SLEEP
+/*==============================================================================
+ * IDLE
+ *============================================================================*/
+// Sleep when there is no input to process and no task is due for at least
+// IDLE_SLEEP_MIN_MILLIS, as a shorter nap would save little.  Idle mode 
+// keeps the timers running, so the millis() timer interrupt wakes the 
+// processor at least every millisecond and task deadlines are still met.
+// A UART receive or pin interrupt wakes it as soon as there is work.  This
+// relies on timer0 ticking, so it is only built with INCLUDE_IDLE_SLEEP.
+static void idleSleep()
+{
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    // Interrupts are held off while checking, and sei() only takes effect
+    // after the following instruction, so a byte arriving after the check
+    // wakes the processor from sleep_cpu() rather than being missed.
+    cli();
+    if (!processingMessage() && Serial.available() == 0 &&
+        schedulerIdleMillis() >= IDLE_SLEEP_MIN_MILLIS)
         {
-        schedulerRunTasks();
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
         }
+    sei();
 }
+#endif
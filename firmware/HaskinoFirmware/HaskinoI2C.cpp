@@ -11,21 +11,17 @@ static bool handleConfig(int size, const byte *msg, CONTEXT *context);
 static bool handleRead(int size, const byte *msg, CONTEXT *context);
 static bool handleWrite(int size, const byte *msg, CONTEXT *context);
 
+static const MessageHandler i2cHandlers[] PROGMEM =
+    {
+    handleConfig,            // I2C_CMD_CONFIG
+    handleRead,              // I2C_CMD_READ
+    handleWrite,             // I2C_CMD_WRITE
+    };
+
 bool parseI2CMessage(int size, const byte *msg, CONTEXT *context)
     {
-    switch (msg[0] ) 
-        {
-        case I2C_CMD_CONFIG:
-            return handleConfig(size, msg, context);
-            break;
-        case I2C_CMD_READ:
-            return handleRead(size, msg, context);
-            break;
-        case I2C_CMD_WRITE:
-            return handleWrite(size, msg, context);
-            break;
-        }
-    return false;
+    return dispatchMessage(i2cHandlers, DISPATCH_SIZE(i2cHandlers),
+                           size, msg, context);
     }
 
 static bool handleConfig(int size, const byte *msg, CONTEXT *context)
@@ -8,28 +8,21 @@
 
 static void  *haskinoRefs[MAX_REFS];
 
-static bool handleNewRef(int type, int size, const byte *msg, CONTEXT *context);
-static bool handleReadRef(int type, int size, const byte *msg, CONTEXT *context);
-static bool handleWriteRef(int type, int size, const byte *msg, CONTEXT *context);
+static bool handleNewRef(int size, const byte *msg, CONTEXT *context);
+static bool handleReadRef(int size, const byte *msg, CONTEXT *context);
+static bool handleWriteRef(int size, const byte *msg, CONTEXT *context);
 
-bool parseRefMessage(int size, const byte *msg, CONTEXT *context)
+static const MessageHandler refHandlers[] PROGMEM =
     {
-    byte cmd = msg[0];
-    byte type = msg[1];
+    handleNewRef,            // REF_CMD_NEW
+    handleReadRef,           // REF_CMD_READ
+    handleWriteRef,          // REF_CMD_WRITE
+    };
 
-    switch (cmd) 
-        {
-        case REF_CMD_NEW:
-            handleNewRef(type, size, msg, context);
-            break;
-        case REF_CMD_READ:
-            handleReadRef(type, size, msg, context);
-            break;
-        case REF_CMD_WRITE:
-            handleWriteRef(type, size, msg, context);
-            break;
-        }
-    return false;
+bool parseRefMessage(int size, const byte *msg, CONTEXT *context)
+    {
+    return dispatchMessage(refHandlers, DISPATCH_SIZE(refHandlers),
+                           size, msg, context);
     }
 
 bool readRefBool(int refIndex)
@@ -161,8 +154,9 @@ void storeList8Ref(byte *expr, CONTEXT *context, byte refIndex)
         }    
     }
 
-static bool handleNewRef(int type, int size, const byte *msg, CONTEXT *context)
+static bool handleNewRef(int size, const byte *msg, CONTEXT *context)
     {
+    byte type = msg[1];
     byte bind = msg[2];
     byte refIndex = msg[3];
     byte *expr = (byte *) &msg[4];
@@ -222,8 +216,9 @@ static bool handleNewRef(int type, int size, const byte *msg, CONTEXT *context)
     return false;
     }
 
-static bool handleReadRef(int type, int size, const byte *msg, CONTEXT *context)
+static bool handleReadRef(int size, const byte *msg, CONTEXT *context)
     {
+    byte type = msg[1];
     byte bind = msg[2];
     byte *expr = (byte *) &msg[3];
     byte refIndex = evalWord8Expr(&expr, context);
@@ -275,8 +270,9 @@ static bool handleReadRef(int type, int size, const byte *msg, CONTEXT *context)
     return false;
     }
 
-static bool handleWriteRef(int type, int size, const byte *msg, CONTEXT *context)
+static bool handleWriteRef(int size, const byte *msg, CONTEXT *context)
     {
+    byte type = msg[1];
     byte *expr = (byte *) &msg[2];
     byte refIndex = evalWord8Expr(&expr, context);
 
@@ -1,13 +1,47 @@
 #include <Arduino.h>
 #include <EEPROM.h>
+#include <avr/eeprom.h>
+#include <stddef.h>
 #include "HaskinoCodeBlock.h"
 #include "HaskinoComm.h"
 #include "HaskinoCommands.h"
 #include "HaskinoConfig.h"
 #include "HaskinoExpr.h"
 #include "HaskinoScheduler.h"
+#ifdef BOOT_IMAGE_FLASH
+#include "HaskinoBootImage.h"
+#endif
+
+#define BOOT_IMAGE_VERSION      2
+#define BOOT_RECORD_PACKED      0x01
+
+typedef struct boot_header_t
+    {
+    byte        magic[4];
+    uint16_t    crc;
+    byte        version;
+    byte        taskCount;
+    uint16_t    length;
+    } BOOT_HEADER;
+
+typedef struct boot_record_t
+    {
+    byte        id;
+    byte        flags;
+    uint16_t    taskLen;
+    uint16_t    bindSize;
+    uint16_t    storedLen;
+    uint32_t    startMillis;
+    } BOOT_RECORD;
+
+typedef struct boot_writer_t
+    {
+    uint16_t    index;
+    uint16_t    crc;
+    bool        write;
+    } BOOT_WRITER;
 
-#define BOOT_TASK_INDEX_START   5
+static const byte bootMagic[4] = {'H', 'A', 'S', 'K'};
 
 static bool handleQueryAll(int size, const byte *msg, CONTEXT *context);
 static bool handleCreateTask(int size, const byte *msg, CONTEXT *context);
@@ -23,10 +57,55 @@ static bool handleReset(int size, const byte *msg, CONTEXT *context);
 static bool handleBootTask(int size, const byte *msg, CONTEXT *context);
 static bool handleTakeSem(int size, const byte *msg, CONTEXT *context);
 static bool handleGiveSem(int size, const byte *msg, CONTEXT *context);
+static bool handlePeriodicTask(int size, const byte *msg, CONTEXT *context);
+static bool handleQueryOverruns(int size, const byte *msg, CONTEXT *context);
+static bool handleTakeSemTimed(int size, const byte *msg, CONTEXT *context);
+static bool handleQuerySem(int size, const byte *msg, CONTEXT *context);
+static bool handleQueueCreate(int size, const byte *msg, CONTEXT *context);
+static bool handleQueueSend(int size, const byte *msg, CONTEXT *context);
+static bool handleQueueRecv(int size, const byte *msg, CONTEXT *context);
+static bool handleStreamTask(int size, const byte *msg, CONTEXT *context);
+static bool handleTaskBudget(int size, const byte *msg, CONTEXT *context);
+static bool handleSwapTask(int size, const byte *msg, CONTEXT *context);
+static void bootEmit(BOOT_WRITER *writer, const void *src, uint16_t n);
+static uint16_t bootCrc(uint16_t crc, const byte *data, uint16_t n);
+static void packBootBody(BOOT_WRITER *writer, const byte *data, uint16_t len);
+static byte emitBootRecords(BOOT_WRITER *writer, const byte *ids, 
+                            unsigned int idsLen);
+static void unpackBootBody(uint16_t index, byte *data, uint16_t len);
+static bool readBootHeader(BOOT_HEADER *header);
+#ifdef BOOT_IMAGE_FLASH
+static void bootFlashTasks();
+#endif
+static void appendWaiter(TASK **first, TASK **last, TASK *task);
+static void removeWaiter(TASK *task);
 static void deleteTask(TASK* task);
 static TASK *findTask(int id);
+static TASK *allocTask(unsigned int taskSize, unsigned int bindSize);
+static void layoutTask(TASK *task);
+static void initTask(TASK *task, byte id, unsigned int taskSize, 
+                     unsigned int bindSize);
+static void retargetTask(TASK *from, TASK *to);
+static void relocateTask(TASK *from, TASK *to);
+static void dropShadow(TASK *task);
+static void releaseTask(TASK *task);
+static TASK *swapTask(TASK *task);
+static void compactArena();
 static bool createById(byte id, unsigned int taskSize, unsigned int bindSize);
 static bool scheduleById(byte id, unsigned long deltaMillis);
+static void armTask(TASK *task, uint32_t base, unsigned long deltaMillis,
+                    unsigned long deltaMicros);
+static void rearmPeriodicTask(TASK *task);
+#ifdef INCLUDE_TASK_STATS
+static void recordTaskStart(TASK *task, uint32_t latency);
+static void recordTaskRun(TASK *task, uint32_t elapsed);
+#endif
+static void readyTask(TASK *task);
+static void unreadyTask(TASK *task);
+static inline uint8_t lock();
+static inline void unlock(uint8_t statReg);
+static bool isInterruptTask(TASK *task);
+static void dispatchIsrEvents();
 static void handleISR(int intNum);
 static void ISR0(void);
 static void ISR1(void);
@@ -40,61 +119,138 @@ static TASK *runningTask = NULL;
 static CONTEXT *defaultContext = NULL;
 static int taskCount = 0;
 static SEMAPHORE semaphores[NUM_SEMAPHORES];
+
+static QUEUE queues[NUM_QUEUES];
+
+// Value of waitSem and waitQueue for a task which is not waiting 
+#define NO_SEMAPHORE        0xFF
+#define NO_QUEUE            0xFF
 static TASK *intTasks[MAX_INTERRUPTS];
 
+// Interrupts attached to tasks are only recorded by the ISR, and the tasks
+// are run later by the scheduler, so interrupts are never held off for
+// the length of a task.  The ISRs are the only writers of the head, and the
+// scheduler is the only writer of the tail, so the queue needs no lock.
+#define ISR_EVENT_QUEUE_MASK (ISR_EVENT_QUEUE_SIZE - 1)
+
+typedef struct isr_event_t
+    {
+    byte        intNum;
+    uint32_t    time;
+    } ISR_EVENT;
+
+static ISR_EVENT isrEvents[ISR_EVENT_QUEUE_SIZE];
+static volatile byte isrEventHead = 0;
+static volatile byte isrEventTail = 0;
+
+// Tasks are found through a table indexed by task id, so lookups do not
+// walk the task list.  Ids below TASK_TABLE_SIZE have a slot to themselves,
+// and larger ids share the slot of their low bits through hashNext.  With
+// a table of 256 slots every id has its own slot, and the chains are never
+// longer than one task.
+#define TASK_TABLE_MASK     (TASK_TABLE_SIZE - 1)
+
+static TASK *taskTable[TASK_TABLE_SIZE];
+
+// Ready tasks are kept on the readyNext list in deadline order, so the
+// scheduler only looks at the head of the list to find what is due.  The
+// running task is off the list while it runs, and is put back in order of
+// its new deadline if it is still ready when it yields.
+static TASK *readyList = NULL;
+
+// All tasks live in a single arena, each in one block holding the TASK and
+// its code, followed by its CONTEXT and binds.  Blocks are taken from the
+// top of the arena, and the arena is compacted by sliding the blocks above
+// a deleted task down, so it never fragments.  Blocks are only moved when 
+// no task is running, as the running task holds pointers into its own 
+// block.  A task deleted while a task runs is left in place with a NULL 
+// context, and its block is reclaimed on the next scheduler pass.  Once 
+// the arena is full, blocks are allocated from the heap instead, and are
+// never moved.
+#define ARENA_ALIGN(n)      (((n) + 3UL) & ~3UL)
+
+static byte taskArena[TASK_ARENA_SIZE] __attribute__ ((aligned (4)));
+static byte *arenaTop = taskArena;
+static bool arenaHoles = false;
+static uint16_t arenaFailures = 0;
+
+// Task whose code is being written by stream frames, the length its code
+// will have once the stream is complete, and the CRC the code must have.
+static TASK *streamTask = NULL;
+static uint16_t streamLength;
+static uint16_t streamCrc;
+
+// Task deadlines are kept in micros(), which wraps about every 71 minutes,
+// so they are only ever compared as signed differences.  A delay longer
+// than SCHED_MAX_WAIT_MILLIS is split, and the remainder is held in
+// holdMillis and armed when the first part has passed.
+#define SCHED_MAX_WAIT_MILLIS   1000000UL
+
+static void armTask(TASK *task, uint32_t base, unsigned long deltaMillis,
+                    unsigned long deltaMicros)
+    {
+    deltaMillis += deltaMicros / 1000;
+    deltaMicros %= 1000;
+    if (deltaMillis > SCHED_MAX_WAIT_MILLIS)
+        {
+        task->holdMillis = deltaMillis - SCHED_MAX_WAIT_MILLIS;
+        deltaMillis = SCHED_MAX_WAIT_MILLIS;
+        }
+    else
+        {
+        task->holdMillis = 0;
+        }
+    task->wake = base + deltaMillis * 1000UL + deltaMicros;
+    }
+
 int getTaskCount()
     {
     return taskCount;
     }
 
+static const MessageHandler schedulerHandlers[] PROGMEM =
+    {
+    handleCreateTask,        // SCHED_CMD_CREATE_TASK
+    handleDeleteTask,        // SCHED_CMD_DELETE_TASK
+    handleAddToTask,         // SCHED_CMD_ADD_TO_TASK
+    handleScheduleTask,      // SCHED_CMD_SCHED_TASK
+    handleQuery,             // SCHED_CMD_QUERY
+    handleQueryAll,          // SCHED_CMD_QUERY_ALL
+    handleReset,             // SCHED_CMD_RESET
+    handleBootTask,          // SCHED_CMD_BOOT_TASK
+    handleTakeSem,           // SCHED_CMD_TAKE_SEM
+    handleGiveSem,           // SCHED_CMD_GIVE_SEM
+    handleAttachInterrupt,   // SCHED_CMD_ATTACH_INT
+    handleDetachInterrupt,   // SCHED_CMD_DETACH_INT
+    handleInterrupts,        // SCHED_CMD_INTERRUPTS
+    handleNoInterrupts,      // SCHED_CMD_NOINTERRUPTS
+    handlePeriodicTask,      // SCHED_CMD_PERIODIC
+    handleQueryOverruns,     // SCHED_CMD_OVERRUNS
+    };
+
 bool parseSchedulerMessage(int size, const byte *msg, CONTEXT *context)
     {
-    switch (msg[0]) 
-        {
-        case SCHED_CMD_QUERY_ALL:
-            return handleQueryAll(size, msg, context);
-            break;
-        case SCHED_CMD_CREATE_TASK:
-            return handleCreateTask(size, msg, context);
-            break;
-        case SCHED_CMD_DELETE_TASK:
-            return handleDeleteTask(size, msg, context);
-            break;
-        case SCHED_CMD_ADD_TO_TASK:
-            return handleAddToTask(size, msg, context);
-            break;
-        case SCHED_CMD_SCHED_TASK:
-            return handleScheduleTask(size, msg, context);
-            break;
-        case SCHED_CMD_ATTACH_INT:
-            return handleAttachInterrupt(size, msg, context);
-            break;
-        case SCHED_CMD_DETACH_INT:
-            return handleDetachInterrupt(size, msg, context);
-            break;
-        case SCHED_CMD_INTERRUPTS:
-            return handleInterrupts(size, msg, context);
-            break;
-        case SCHED_CMD_NOINTERRUPTS:
-            return handleNoInterrupts(size, msg, context);
-            break;
-        case SCHED_CMD_QUERY:
-            return handleQuery(size, msg, context);
-            break;
-        case SCHED_CMD_RESET:
-            return handleReset(size, msg, context);
-            break;
-        case SCHED_CMD_BOOT_TASK:
-            return handleBootTask(size, msg, context);
-            break;
-        case SCHED_CMD_TAKE_SEM:
-            return handleTakeSem(size, msg, context);
-            break;
-        case SCHED_CMD_GIVE_SEM:
-            return handleGiveSem(size, msg, context);
-            break;
-       }
-    return false;
+    return dispatchMessage(schedulerHandlers, DISPATCH_SIZE(schedulerHandlers),
+                           size, msg, context);
+    }
+
+static const MessageHandler schedulerExtHandlers[] PROGMEM =
+    {
+    handleTakeSemTimed,      // SCHED_CMD_TAKE_SEM_TIMED
+    handleQuerySem,          // SCHED_CMD_QUERY_SEM
+    handleQueueCreate,       // SCHED_CMD_QUEUE_CREATE
+    handleQueueSend,         // SCHED_CMD_QUEUE_SEND
+    handleQueueRecv,         // SCHED_CMD_QUEUE_RECV
+    handleStreamTask,        // SCHED_CMD_STREAM_TASK
+    handleTaskBudget,        // SCHED_CMD_TASK_BUDGET
+    handleSwapTask,          // SCHED_CMD_SWAP_TASK
+    };
+
+bool parseSchedulerExtMessage(int size, const byte *msg, CONTEXT *context)
+    {
+    return dispatchMessage(schedulerExtHandlers, 
+                           DISPATCH_SIZE(schedulerExtHandlers),
+                           size, msg, context);
     }
 
 CONTEXT *schedulerDefaultContext()
@@ -112,58 +268,234 @@ CONTEXT *schedulerDefaultContext()
 
 static TASK *findTask(int id)
     {
-    TASK *task = firstTask;
+    TASK *task = taskTable[id & TASK_TABLE_MASK];
 
-    while (task != NULL)
+    while (task != NULL && task->id != id)
         {
-        if (id == task->id)
-            return task;
-        task = task->next;
+        task = task->hashNext;
         }
-    return NULL;
+    return task;
     }
 
 static bool createById(byte id, unsigned int taskSize, unsigned int bindSize)
     {
     TASK *newTask;
-    CONTEXT *newContext;
-    byte *bind;
 
     if ((findTask(id) == NULL) &&
-         ((newTask = (TASK *) malloc(taskSize + sizeof(TASK))) != NULL ))
+         ((newTask = allocTask(taskSize, bindSize)) != NULL ))
+        {
+        initTask(newTask, id, taskSize, bindSize);
+        newTask->next = firstTask;
+        newTask->prev = NULL;
+        if (firstTask != NULL)
+            firstTask->prev = newTask;
+        firstTask = newTask;
+        newTask->hashNext = taskTable[id & TASK_TABLE_MASK];
+        taskTable[id & TASK_TABLE_MASK] = newTask;
+        taskCount++;
+        }
+
+    return false;
+    }
+
+// Set up a newly allocated task, which is not yet on any list
+static void initTask(TASK *task, byte id, unsigned int taskSize, 
+                     unsigned int bindSize)
+    {
+    CONTEXT *context;
+
+    task->size = taskSize;
+    layoutTask(task);
+    context = task->context;
+    task->next = NULL;
+    task->prev = NULL;
+    task->hashNext = NULL;
+    task->readyNext = NULL;
+    task->waitNext = NULL;
+    task->shadow = NULL;
+    task->id = id;
+    task->currLen = 0;
+    task->currPos = 0;
+    task->wake = 0;
+    task->holdMillis = 0;
+    task->period = 0;
+    task->release = 0;
+#ifdef INCLUDE_TASK_BUDGET
+    task->budget = 0;
+    task->sliceStart = 0;
+#endif
+    task->overruns = 0;
+    task->pendingEvents = 0;
+    task->waitSem = NO_SEMAPHORE;
+    task->waitQueue = NO_QUEUE;
+    task->waitBind = 0;
+    task->waitTimed = false;
+    task->ready = false;
+    task->rescheduled = false;
+    task->keepBinds = false;
+#ifdef BOOT_IMAGE_FLASH
+    task->flashData = NULL;
+#endif
+#ifdef INCLUDE_TASK_STATS
+    memset(&task->stats, 0, sizeof(task->stats));
+#endif
+    context->currBlockLevel = -1;
+    context->recallBlockLevel = -1;
+    context->bindSize = bindSize;
+    memset(context->bind, 0, bindSize * BIND_SPACING);
+    }
+
+static TASK *allocTask(unsigned int taskSize, unsigned int bindSize)
+    {
+    unsigned long blockSize = 
+        ARENA_ALIGN(ARENA_ALIGN(sizeof(TASK) + (unsigned long) taskSize) +
+                    ARENA_ALIGN(sizeof(CONTEXT)) + 
+                    (unsigned long) bindSize * BIND_SPACING);
+    TASK *task;
+
+    if (arenaHoles && runningTask == NULL)
+        {
+        compactArena();
+        }
+    if (blockSize <= (unsigned long) (&taskArena[TASK_ARENA_SIZE] - arenaTop))
+        {
+        task = (TASK *) arenaTop;
+        task->inHeap = false;
+        arenaTop += blockSize;
+        }
+    else if (blockSize <= 0xFFFF && 
+             (task = (TASK *) malloc(blockSize)) != NULL)
+        {
+        task->inHeap = true;
+        }
+    else
         {
-        if ((newContext = (CONTEXT *) malloc(sizeof(CONTEXT))) == NULL)
+        if (arenaFailures != 0xFFFF)
             {
-            free(newTask);
+            arenaFailures++;
             }
-        else if ((bind = (byte *) calloc(1,bindSize*BIND_SPACING)) == NULL)
+        return NULL;
+        }
+    task->blockSize = blockSize;
+    return task;
+    }
+
+// Point a task at the CONTEXT and binds which follow its code in its block
+static void layoutTask(TASK *task)
+    {
+    byte *block = (byte *) task;
+    CONTEXT *context = (CONTEXT *) 
+        &block[ARENA_ALIGN(sizeof(TASK) + (unsigned long) task->size)];
+
+    task->context = context;
+    context->task = task;
+    context->bind = (byte *) context + ARENA_ALIGN(sizeof(CONTEXT));
+    }
+
+static inline void relinkTask(TASK **link, TASK *from, TASK *to)
+    {
+    if (*link == from)
+        {
+        *link = to;
+        }
+    }
+
+// Point everything which refers to one task at another.  The ISRs never
+// refer to tasks, so this does not need to hold off interrupts.
+static void retargetTask(TASK *from, TASK *to)
+    {
+    TASK *task = firstTask;
+
+    while (task != NULL)
+        {
+        TASK *next = task->next;
+
+        relinkTask(&task->next, from, to);
+        relinkTask(&task->prev, from, to);
+        relinkTask(&task->hashNext, from, to);
+        relinkTask(&task->readyNext, from, to);
+        relinkTask(&task->waitNext, from, to);
+        relinkTask(&task->shadow, from, to);
+        task = next;
+        }
+    relinkTask(&firstTask, from, to);
+    relinkTask(&readyList, from, to);
+    relinkTask(&streamTask, from, to);
+    relinkTask(&taskTable[from->id & TASK_TABLE_MASK], from, to);
+    for (int i = 0; i < MAX_INTERRUPTS; i++)
+        {
+        relinkTask(&intTasks[i], from, to);
+        }
+    for (int i = 0; i < NUM_SEMAPHORES; i++)
+        {
+        relinkTask(&semaphores[i].firstWaiter, from, to);
+        relinkTask(&semaphores[i].lastWaiter, from, to);
+        }
+    for (int i = 0; i < NUM_QUEUES; i++)
+        {
+        relinkTask(&queues[i].firstWaiter, from, to);
+        relinkTask(&queues[i].lastWaiter, from, to);
+        }
+    }
+
+// Move a task's block down the arena, first pointing everything which 
+// refers to the task at its new place.
+static void relocateTask(TASK *from, TASK *to)
+    {
+    retargetTask(from, to);
+    memmove(to, from, from->blockSize);
+    layoutTask(to);
+    }
+
+static void compactArena()
+    {
+    byte *src = taskArena;
+    byte *dst = taskArena;
+
+    while (src < arenaTop)
+        {
+        TASK *task = (TASK *) src;
+        uint16_t blockSize = task->blockSize;
+
+        if (task->context != NULL)
             {
-            free(newContext);
-            free(newTask);
+            if (dst != src)
+                {
+                relocateTask(task, (TASK *) dst);
+                }
+            dst += blockSize;
             }
-        else
+        src += blockSize;
+        }
+    arenaTop = dst;
+    arenaHoles = false;
+    }
+
+void schedulerArenaStats(ARENA_STATS *stats)
+    {
+    byte *block = taskArena;
+    uint16_t used = 0;
+
+    while (block < arenaTop)
+        {
+        TASK *task = (TASK *) block;
+
+        if (task->context != NULL)
             {
-            newTask->next = firstTask;
-            newTask->prev = NULL;
-            newTask->context = newContext;
-            firstTask = newTask;
-            newTask->id = id;
-            newTask->size = taskSize;
-            newTask->currLen = 0;
-            newTask->currPos = 0;
-            newTask->ready = false;
-            newTask->rescheduled = false;
-            newTask->endData = newTask->data + newTask->size;
-            newContext->currBlockLevel = -1;
-            newContext->recallBlockLevel = -1;
-            newContext->task = newTask;
-            newContext->bindSize = bindSize;
-            newContext->bind = bind;
+            used += task->blockSize;
             }
-        taskCount++;
+        block += task->blockSize;
         }
 
-    return false;
+    stats->size = TASK_ARENA_SIZE;
+    stats->free = TASK_ARENA_SIZE - used;
+    stats->largest = &taskArena[TASK_ARENA_SIZE] - arenaTop;
+    if (arenaHoles && runningTask == NULL)
+        {
+        // The holes would be closed up before the next allocation
+        stats->largest = stats->free;
+        }
+    stats->failures = arenaFailures;
     }
 
 static bool handleCreateTask(int size, const byte *msg, CONTEXT *context)
@@ -176,8 +508,97 @@ static bool handleCreateTask(int size, const byte *msg, CONTEXT *context)
     return createById(id, taskSize, bindSize);
     }
 
+static void queueTask(TASK *task)
+    {
+    TASK **link = &readyList;
+
+    // Tasks with the same deadline run in the order they became ready
+    while (*link != NULL && (int32_t) ((*link)->wake - task->wake) <= 0)
+        {
+        link = &(*link)->readyNext;
+        }
+    task->readyNext = *link;
+    *link = task;
+    }
+
+static void unqueueTask(TASK *task)
+    {
+    TASK **link = &readyList;
+
+    while (*link != NULL)
+        {
+        if (*link == task)
+            {
+            *link = task->readyNext;
+            return;
+            }
+        link = &(*link)->readyNext;
+        }
+    }
+
+static void readyTask(TASK *task)
+    {
+    uint8_t reg = lock();
+
+    task->ready = true;
+    if (task != runningTask)
+        {
+        unqueueTask(task);
+        queueTask(task);
+        }
+    unlock(reg);
+    }
+
+static void unreadyTask(TASK *task)
+    {
+    uint8_t reg = lock();
+
+    task->ready = false;
+    if (task != runningTask)
+        {
+        unqueueTask(task);
+        }
+    unlock(reg);
+    }
+
 static void deleteTask(TASK* task)
     {
+    TASK **slot = &taskTable[task->id & TASK_TABLE_MASK];
+
+    // A task which deleted itself is already gone when its run ends
+    if (task->context == NULL)
+        {
+        return;
+        }
+
+    unreadyTask(task);
+
+    if (task->waitSem != NO_SEMAPHORE || task->waitQueue != NO_QUEUE)
+        {
+        uint8_t reg = lock();
+        removeWaiter(task);
+        unlock(reg);
+        }
+
+    for (int i = 0; i < MAX_INTERRUPTS; i++)
+        {
+        if (intTasks[i] == task)
+            {
+            intTasks[i] = NULL;
+            }
+        }
+
+    if (streamTask == task)
+        {
+        streamTask = NULL;
+        }
+    dropShadow(task);
+
+    while (*slot != NULL && *slot != task)
+        slot = &(*slot)->hashNext;
+    if (*slot != NULL)
+        *slot = task->hashNext;
+
     if (task->prev != NULL)
         task->prev->next = task->next;
     else
@@ -185,8 +606,29 @@ static void deleteTask(TASK* task)
     if (task->next != NULL)
         task->next->prev = task->prev;
     taskCount--;
-    free(task->context);
-    free(task);
+
+    releaseTask(task);
+    if (arenaHoles && runningTask == NULL)
+        {
+        compactArena();
+        }
+    }
+
+// Give up the block of a task which is no longer on any list.  An arena 
+// block is left as a hole until the next compaction.  A heap block is 
+// freed, except for the running task's, which the scheduler frees once
+// the task's run ends.
+static void releaseTask(TASK *task)
+    {
+    task->context = NULL;
+    if (!task->inHeap)
+        {
+        arenaHoles = true;
+        }
+    else if (task != runningTask)
+        {
+        free(task);
+        }
     }
 
 static bool handleDeleteTask(int size, const byte *msg, CONTEXT *context)
@@ -212,6 +654,11 @@ static bool handleAddToTask(int size, const byte *msg, CONTEXT *context)
 
     if ((task = findTask(id)) != NULL)
         {
+        // Code for a task being replaced goes to its shadow
+        if (task->shadow != NULL)
+            {
+            task = task->shadow;
+            }
         if (addSize + task->currLen <= task->size)
             {
             memcpy(&task->data[task->currLen], data, addSize);
@@ -227,8 +674,9 @@ static bool scheduleById(byte id, unsigned long deltaMillis)
 
     if ((task = findTask(id)) != NULL)
         {
-        task->millis = millis() + deltaMillis;
-        task->ready = true;
+        task->period = 0;
+        armTask(task, micros(), deltaMillis, 0);
+        readyTask(task);
         }
     return false;
     }
@@ -241,6 +689,160 @@ static bool handleScheduleTask(int size, const byte *msg, CONTEXT *context)
     return scheduleById(id, deltaMillis);
     }
 
+static bool handlePeriodicTask(int size, const byte *msg, CONTEXT *context)
+    {
+    byte *expr = (byte *) &msg[1];
+    byte id = evalWord8Expr(&expr, context);
+    unsigned long deltaMillis = evalWord32Expr(&expr, context);
+    unsigned long periodMicros = evalWord32Expr(&expr, context);
+    TASK *task;
+
+    if ((task = findTask(id)) != NULL)
+        {
+        task->period = periodMicros;
+        task->overruns = 0;
+        armTask(task, micros(), deltaMillis, 0);
+        readyTask(task);
+        }
+    return false;
+    }
+
+// Load replacement code for a task into a shadow task, while the task
+// keeps running its old code.  The shadow is filled by SCHED_CMD_ADD_TO_TASK
+// or a stream as a new task would be, and replaces the task at the start
+// of the task's first run after the whole of its code has been loaded.  
+// The task's binds are either carried over or cleared.  Loading another 
+// replacement drops any earlier one which has not yet been swapped in.
+static bool handleSwapTask(int size, const byte *msg, CONTEXT *context)
+    {
+    byte *expr = (byte *) &msg[1];
+    byte id = evalWord8Expr(&expr, context);
+    unsigned int taskSize = evalWord16Expr(&expr, context);
+    unsigned int bindSize = evalWord16Expr(&expr, context);
+    bool keepBinds = evalBoolExpr(&expr, context);
+    TASK *task = findTask(id);
+    TASK *shadow;
+
+    if (task == NULL
+#ifdef BOOT_IMAGE_FLASH
+        || task->flashData != NULL
+#endif
+        )
+        {
+        return false;
+        }
+
+    dropShadow(task);
+    if ((shadow = allocTask(taskSize, bindSize)) != NULL)
+        {
+        // Allocation may have compacted the arena and moved the task
+        task = findTask(id);
+        initTask(shadow, id, taskSize, bindSize);
+        shadow->keepBinds = keepBinds;
+        task->shadow = shadow;
+        }
+    return false;
+    }
+
+static void dropShadow(TASK *task)
+    {
+    if (task->shadow != NULL)
+        {
+        if (streamTask == task->shadow)
+            {
+            streamTask = NULL;
+            }
+        releaseTask(task->shadow);
+        task->shadow = NULL;
+        }
+    }
+
+// Replace a task with its shadow, if the shadow's code is complete.  This
+// is only done between runs of the task, so nothing refers into the old 
+// task's context.  The shadow takes over the task's scheduling state and
+// every reference to the task, and the old task's block is released.
+static TASK *swapTask(TASK *task)
+    {
+    TASK *shadow = task->shadow;
+    bool inHeap = shadow->inHeap;
+    uint16_t blockSize = shadow->blockSize;
+    uint16_t size = shadow->size;
+    uint16_t currLen = shadow->currLen;
+    CONTEXT *context = shadow->context;
+
+    if (currLen != size || shadow == streamTask)
+        {
+        return task;
+        }
+
+    if (shadow->keepBinds)
+        {
+        uint16_t bindSize = context->bindSize;
+
+        if (task->context->bindSize < bindSize)
+            {
+            bindSize = task->context->bindSize;
+            }
+        memcpy(context->bind, task->context->bind, bindSize * BIND_SPACING);
+        }
+
+    memcpy(shadow, task, sizeof(TASK));
+    shadow->inHeap = inHeap;
+    shadow->blockSize = blockSize;
+    shadow->size = size;
+    shadow->currLen = currLen;
+    shadow->currPos = 0;
+    shadow->shadow = NULL;
+    layoutTask(shadow);
+
+    retargetTask(task, shadow);
+    releaseTask(task);
+    return shadow;
+    }
+
+// Limit how long a task may run before it yields to the rest of the loop.
+// The budget is checked between commands, so a task overruns it by up to
+// the time of one command.  A budget of 0 lets the task run until it
+// delays or finishes.
+static bool handleTaskBudget(int size, const byte *msg, CONTEXT *context)
+    {
+#ifdef INCLUDE_TASK_BUDGET
+    byte *expr = (byte *) &msg[1];
+    byte id = evalWord8Expr(&expr, context);
+    unsigned long budgetMicros = evalWord32Expr(&expr, context);
+    TASK *task;
+
+    if ((task = findTask(id)) != NULL)
+        {
+        task->budget = budgetMicros;
+        }
+#endif
+    return false;
+    }
+
+static bool handleQueryOverruns(int size, const byte *msg, CONTEXT *context)
+    {
+    byte bind = msg[1];
+    byte *expr = (byte *) &msg[2];
+    byte id = evalWord8Expr(&expr, context);
+    uint16_t overruns = 0;
+    byte overrunReply[4];
+    TASK *task;
+
+    if ((task = findTask(id)) != NULL)
+        {
+        overruns = task->overruns;
+        }
+
+    overrunReply[0] = EXPR_WORD16;
+    overrunReply[1] = EXPR_LIT;
+    memcpy(&overrunReply[2], &overruns, sizeof(overruns));
+
+    sendReply(sizeof(overrunReply), SCHED_RESP_OVERRUNS, 
+              overrunReply, context, bind);
+    return false;
+    }
+
 static bool handleAttachInterrupt(int size, const byte *msg, CONTEXT *context)
     {
     byte *expr = (byte *) &msg[1];
@@ -313,7 +915,11 @@ static bool handleQuery(int size, const byte *msg, CONTEXT *context)
     {
     byte *expr = (byte *) &msg[2];
     byte id = evalWord8Expr(&expr, context);
+#ifdef INCLUDE_TASK_STATS
+    byte queryReply[10 + sizeof(TASK_STATS)];
+#else
     byte queryReply[10];
+#endif
     uint16_t *sizeReply = (uint16_t *) queryReply;
     uint16_t *lenReply = (uint16_t *) &queryReply[2];
     uint16_t *posReply = (uint16_t *) &queryReply[4];
@@ -324,7 +930,19 @@ static bool handleQuery(int size, const byte *msg, CONTEXT *context)
         *sizeReply = task->size;
         *lenReply = task->currLen;
         *posReply = task->currPos;
-        *millisReply = task->millis - millis();
+        // A task which is not waiting to run has no time to run
+        if (task->ready)
+            {
+            *millisReply = (int32_t) (task->wake - micros()) / 1000 +
+                           task->holdMillis;
+            }
+        else
+            {
+            *millisReply = 0;
+            }
+#ifdef INCLUDE_TASK_STATS
+        memcpy(&queryReply[10], &task->stats, sizeof(TASK_STATS));
+#endif
         sendReply(sizeof(queryReply), SCHED_RESP_QUERY, queryReply, context, 0);
         }
     else
@@ -393,82 +1011,250 @@ static bool handleReset(int size, const byte *msg, CONTEXT *context)
     return false;
     }
 
-static bool handleBootTask(int size, const byte *msg, CONTEXT *context)
+// The boot image is a header followed by a record and body for each task.
+// The header CRC covers the records and bodies, and then the rest of the
+// header, so a partly written or corrupt image is never booted.  The image
+// is written with eeprom_update_block(), so bytes which are unchanged from
+// the last image are not rewritten.
+static void bootEmit(BOOT_WRITER *writer, const void *src, uint16_t n)
     {
-    byte bind = msg[1];
-    byte *expr = (byte *) &msg[2];
-    bool alloc;
-    byte *ids = evalList8Expr(&expr, context, &alloc);
-    byte bootReply[3];
-    byte status = 1;
-    unsigned int index = BOOT_TASK_INDEX_START;
-    unsigned int idsLen = ids[1];
-    unsigned int taskCount = 0;
+    if (writer->write)
+        {
+        eeprom_update_block(src, (void *) (uintptr_t) writer->index, n);
+        }
+    writer->crc = bootCrc(writer->crc, (const byte *) src, n);
+    writer->index += n;
+    }
+
+static uint16_t bootCrc(uint16_t crc, const byte *data, uint16_t n)
+    {
+    for (uint16_t i = 0; i < n; i++)
+        {
+        crc = crc16Update(crc, data[i]);
+        }
+    return crc;
+    }
 
-    /* Write the Magic pattern */
-    EEPROM[ 0 ] = 'H';
-    EEPROM[ 1 ] = 'A';
-    EEPROM[ 2 ] = 'S';
-    EEPROM[ 3 ] = 'K';
+// Packed task bodies are a sequence of a control byte below 
+// BOOT_PACK_RUN followed by that many plus one literal bytes, or a control
+// byte of BOOT_PACK_RUN or more followed by a byte which is repeated 
+// BOOT_PACK_MIN_RUN more times than the control byte's offset from 
+// BOOT_PACK_RUN.
+#define BOOT_PACK_RUN           0x80
+#define BOOT_PACK_MIN_RUN       3
+#define BOOT_PACK_MAX_RUN       (0xFF - BOOT_PACK_RUN + BOOT_PACK_MIN_RUN)
+#define BOOT_PACK_MAX_LITERAL   BOOT_PACK_RUN
+
+static uint16_t bootRunLength(const byte *data, uint16_t len, uint16_t i)
+    {
+    uint16_t run = 1;
 
-    for (unsigned int i=0; i<idsLen; i++)
+    while (i + run < len && run < BOOT_PACK_MAX_RUN && 
+           data[i + run] == data[i])
         {
-        TASK *task;
-        byte id = ids[2+i];
+        run++;
+        }
+    return run;
+    }
 
-        if ((task = findTask(id)) != NULL)
+static void packBootBody(BOOT_WRITER *writer, const byte *data, uint16_t len)
+    {
+    uint16_t i = 0;
+
+    while (i < len)
+        {
+        uint16_t run = bootRunLength(data, len, i);
+        byte control;
+
+        if (run >= BOOT_PACK_MIN_RUN)
             {
-            unsigned int taskBodyStart;
-            uint32_t startTime;
-            uint32_t now = millis();
+            control = BOOT_PACK_RUN + run - BOOT_PACK_MIN_RUN;
+            bootEmit(writer, &control, 1);
+            bootEmit(writer, &data[i], 1);
+            i += run;
+            }
+        else
+            {
+            uint16_t start = i;
 
-            if (task->millis == 0 || task->millis < now)
+            while (i < len && i - start < BOOT_PACK_MAX_LITERAL &&
+                   bootRunLength(data, len, i) < BOOT_PACK_MIN_RUN)
                 {
-                startTime = 0;
+                i++;
                 }
-            else
+            control = i - start - 1;
+            bootEmit(writer, &control, 1);
+            bootEmit(writer, &data[start], i - start);
+            }
+        }
+    }
+
+static void unpackBootBody(uint16_t index, byte *data, uint16_t len)
+    {
+    uint16_t i = 0;
+
+    while (i < len)
+        {
+        byte control = eeprom_read_byte((const uint8_t *) (uintptr_t) index++);
+        uint16_t n;
+
+        if (control < BOOT_PACK_RUN)
+            {
+            n = control + 1;
+            if (n > len - i)
                 {
-                startTime = now;
+                n = len - i;
                 }
+            eeprom_read_block(&data[i], (const void *) (uintptr_t) index, n);
+            index += control + 1;
+            }
+        else
+            {
+            n = control - BOOT_PACK_RUN + BOOT_PACK_MIN_RUN;
+            if (n > len - i)
+                {
+                n = len - i;
+                }
+            memset(&data[i], 
+                   eeprom_read_byte((const uint8_t *) (uintptr_t) index++), n);
+            }
+        i += n;
+        }
+    }
+
+// Read the boot image header, and check the image against its CRC, 
+// reading it a block at a time.
+static bool readBootHeader(BOOT_HEADER *header)
+    {
+    byte block[16];
+    uint16_t crc = SEQ_CRC_INIT;
+    uint16_t index = sizeof(BOOT_HEADER);
+    uint16_t left;
+
+    eeprom_read_block(header, (const void *) 0, sizeof(BOOT_HEADER));
+    if (memcmp(header->magic, bootMagic, sizeof(header->magic)) != 0 ||
+        header->version != BOOT_IMAGE_VERSION ||
+        header->length > EEPROM.length() - sizeof(BOOT_HEADER))
+        {
+        return false;
+        }
+
+    for (left = header->length; left != 0; )
+        {
+        uint16_t n = left < sizeof(block) ? left : sizeof(block);
+
+        eeprom_read_block(block, (const void *) (uintptr_t) index, n);
+        crc = bootCrc(crc, block, n);
+        index += n;
+        left -= n;
+        }
+    crc = bootCrc(crc, &header->version, 
+                  sizeof(BOOT_HEADER) - offsetof(BOOT_HEADER, version));
+    return crc == header->crc;
+    }
+
+// Emit the boot record and body of each of the tasks, returning the 
+// number of tasks emitted.
+static byte emitBootRecords(BOOT_WRITER *writer, const byte *ids, 
+                            unsigned int idsLen)
+    {
+    byte taskCount = 0;
 
-            /* Write the task ID */
-            EEPROM[ index++ ] = id;
+    for (unsigned int i=0; i<idsLen; i++)
+        {
+        TASK *task;
+        byte id = ids[i];
 
-            /* Write the length of the task */
-            EEPROM[ index++ ] = task->currLen & 0xFF;
-            EEPROM[ index++ ] = task->currLen >> 8;
+        if ((task = findTask(id)) != NULL)
+            {
+            BOOT_RECORD record;
+            int32_t wait = (int32_t) (task->wake - micros());
 
-            /* Write the number of binds in the task */
-            EEPROM[ index++ ] = task->context->bindSize & 0xFF;
-            EEPROM[ index++ ] = task->context->bindSize >> 8;
+#ifdef BOOT_IMAGE_FLASH
+            /* Tasks in flash are booted from there anyway */
+            if (task->flashData != NULL)
+                {
+                continue;
+                }
+#endif
 
-            /* Write the scheduled time of the task */
-            EEPROM[ index++ ] = startTime & 0xFF;
-            EEPROM[ index++ ] = (startTime >> 8) & 0xFF;
-            EEPROM[ index++ ] = (startTime >> 16) & 0xFF;
-            EEPROM[ index++ ] = startTime >> 24;            
+            record.id = id;
+            record.flags = 0;
+            record.taskLen = task->currLen;
+            record.bindSize = task->context->bindSize;
+            record.storedLen = task->currLen;
 
-            /* Write the body of the task */
-            taskBodyStart = index;
-            for (unsigned int i=0;i<task->currLen;i++,index++)
+            /* Keep the time left before the task runs, if any */
+            if (!task->ready || wait <= 0)
+                {
+                record.startMillis = 0;
+                }
+            else
                 {
-                EEPROM[ index ] = task->data[i];
+                record.startMillis = wait / 1000 + task->holdMillis;
                 }
 
-            /* Validate body writing */
-            index = taskBodyStart;
-            for (unsigned int i=0;i<task->currLen;i++,index++)
+#ifdef BOOT_IMAGE_COMPRESS
+            /* Store the body packed if that makes it smaller */
+            BOOT_WRITER sizer = {0, 0, false};
+
+            packBootBody(&sizer, task->data, task->currLen);
+            if (sizer.index < task->currLen)
                 {
-                if (EEPROM[ index ] != task->data[i])
-                    status = 0;
+                record.flags = BOOT_RECORD_PACKED;
+                record.storedLen = sizer.index;
                 }
-            }
+#endif
 
+            bootEmit(writer, &record, sizeof(record));
+            if (record.flags & BOOT_RECORD_PACKED)
+                {
+                packBootBody(writer, task->data, task->currLen);
+                }
+            else
+                {
+                bootEmit(writer, task->data, task->currLen);
+                }
             taskCount++;
+            }
         }
+    return taskCount;
+    }
 
-    /* Write the number of boot tasks */
-    EEPROM[ 4 ] = taskCount;
+static bool handleBootTask(int size, const byte *msg, CONTEXT *context)
+    {
+    byte bind = msg[1];
+    byte *expr = (byte *) &msg[2];
+    bool alloc;
+    byte *ids = evalList8Expr(&expr, context, &alloc);
+    byte bootReply[3];
+    byte status = 0;
+    unsigned int idsLen = ids[1];
+    BOOT_HEADER header;
+    BOOT_WRITER writer = {sizeof(BOOT_HEADER), SEQ_CRC_INIT, false};
+
+    /* Size the image first, so that an image which does not fit leaves
+       the one already in EEPROM untouched.  The header is only written
+       once the whole image is, so a partly written image fails its CRC. */
+    emitBootRecords(&writer, &ids[2], idsLen);
+    if (writer.index <= EEPROM.length())
+        {
+        writer.index = sizeof(BOOT_HEADER);
+        writer.crc = SEQ_CRC_INIT;
+        writer.write = true;
+        header.taskCount = emitBootRecords(&writer, &ids[2], idsLen);
+
+        memcpy(header.magic, bootMagic, sizeof(header.magic));
+        header.version = BOOT_IMAGE_VERSION;
+        header.length = writer.index - sizeof(BOOT_HEADER);
+        header.crc = bootCrc(writer.crc, &header.version, 
+                             sizeof(BOOT_HEADER) - 
+                             offsetof(BOOT_HEADER, version));
+        eeprom_update_block(&header, (void *) 0, sizeof(BOOT_HEADER));
+
+        /* Validate the image as it will be booted */
+        status = readBootHeader(&header);
+        }
 
     bootReply[0] = EXPR_BOOL;
     bootReply[1] = EXPR_LIT;
@@ -497,6 +1283,60 @@ static inline void unlock(uint8_t statReg)
     SREG = statReg;
     }
 
+// Tasks waiting on a semaphore or a queue are kept in FIFO order on the 
+// waitNext list, and are woken in that order.
+static void appendWaiter(TASK **first, TASK **last, TASK *task)
+    {
+    task->waitNext = NULL;
+    if (*last != NULL)
+        {
+        (*last)->waitNext = task;
+        }
+    else
+        {
+        *first = task;
+        }
+    *last = task;
+    }
+
+static void unlinkWaiter(TASK **first, TASK **last, TASK *task)
+    {
+    TASK **link = first;
+    TASK *prev = NULL;
+
+    while (*link != NULL && *link != task)
+        {
+        prev = *link;
+        link = &(*link)->waitNext;
+        }
+    if (*link == task)
+        {
+        *link = task->waitNext;
+        if (*last == task)
+            {
+            *last = prev;
+            }
+        }
+    }
+
+static void removeWaiter(TASK *task)
+    {
+    if (task->waitSem != NO_SEMAPHORE)
+        {
+        SEMAPHORE *sem = &semaphores[task->waitSem];
+
+        unlinkWaiter(&sem->firstWaiter, &sem->lastWaiter, task);
+        task->waitSem = NO_SEMAPHORE;
+        }
+    if (task->waitQueue != NO_QUEUE)
+        {
+        QUEUE *queue = &queues[task->waitQueue];
+
+        unlinkWaiter(&queue->firstWaiter, &queue->lastWaiter, task);
+        task->waitQueue = NO_QUEUE;
+        }
+    }
+
 static bool handleTakeSem(int size, const byte *msg, CONTEXT *context)
     {
     byte *expr = (byte *) &msg[1];
@@ -507,23 +1347,26 @@ static bool handleTakeSem(int size, const byte *msg, CONTEXT *context)
         uint8_t reg;
 
         reg = lock();
-        // Semaphore is already full, take it and do not reschedule
-        if (semaphores[id].full)
+        // Semaphore has a count, take it and do not reschedule
+        if (semaphores[id].count != 0)
             {
-            semaphores[id].full = false;
+            semaphores[id].count--;
             unlock(reg);
             return false;
             }
         else
-            // Semaphore is not full, we need to add ourselves to waiting
+            // Semaphore is empty, we need to add ourselves to the waiters
             // and reschedule
             {
             TASK *task = context->task;
 
             if (task)
                 {
-                semaphores[id].waiting = task;
-                task->ready = false;
+                task->waitTimed = false;
+                task->waitSem = id;
+                appendWaiter(&semaphores[id].firstWaiter, 
+                             &semaphores[id].lastWaiter, task);
+                unreadyTask(task);
                 }
             unlock(reg);
             return true;
@@ -535,6 +1378,83 @@ static bool handleTakeSem(int size, const byte *msg, CONTEXT *context)
         }
     }
 
+static bool handleTakeSemTimed(int size, const byte *msg, CONTEXT *context)
+    {
+    byte bind = msg[1];
+    byte *expr = (byte *) &msg[2];
+    byte id = evalWord8Expr(&expr, context);
+    unsigned long timeoutMillis = evalWord32Expr(&expr, context);
+    TASK *task = context->task;
+    byte takeReply[3];
+
+    takeReply[0] = EXPR_BOOL;
+    takeReply[1] = EXPR_LIT;
+    takeReply[2] = false;
+
+    if (id < NUM_SEMAPHORES)
+        {
+        uint8_t reg;
+
+        reg = lock();
+        if (semaphores[id].count != 0)
+            {
+            semaphores[id].count--;
+            takeReply[2] = true;
+            }
+        else if (task && timeoutMillis != 0)
+            {
+            // Reply with a timeout now, which is replaced if the 
+            // semaphore is given to the task before the timeout.  The task
+            // runs again at the timeout either way.
+            sendReply(sizeof(takeReply), SCHED_RESP_TAKE_SEM, 
+                      takeReply, context, bind);
+            task->waitTimed = true;
+            task->waitBind = bind;
+            task->waitSem = id;
+            appendWaiter(&semaphores[id].firstWaiter, 
+                         &semaphores[id].lastWaiter, task);
+            armTask(task, micros(), timeoutMillis, 0);
+            readyTask(task);
+            unlock(reg);
+            return true;
+            }
+        unlock(reg);
+        }
+
+    sendReply(sizeof(takeReply), SCHED_RESP_TAKE_SEM, takeReply, context, bind);
+    return false;
+    }
+
+static bool handleQuerySem(int size, const byte *msg, CONTEXT *context)
+    {
+    byte *expr = (byte *) &msg[2];
+    byte id = evalWord8Expr(&expr, context);
+    byte semReply[3];
+    uint16_t *countReply = (uint16_t *) semReply;
+
+    if (id < NUM_SEMAPHORES)
+        {
+        byte waiters = 0;
+        uint8_t reg = lock();
+        TASK *task = semaphores[id].firstWaiter;
+
+        *countReply = semaphores[id].count;
+        while (task != NULL && waiters < 0xFF)
+            {
+            waiters++;
+            task = task->waitNext;
+            }
+        unlock(reg);
+        semReply[2] = waiters;
+        sendReply(sizeof(semReply), SCHED_RESP_QUERY_SEM, semReply, context, 0);
+        }
+    else
+        {
+        sendReply(0, SCHED_RESP_QUERY_SEM, semReply, context, 0);
+        }
+    return false;
+    }
+
 static bool handleGiveSem(int size, const byte *msg, CONTEXT *context)
     {
     byte *expr = (byte *) &msg[1];
@@ -545,96 +1465,653 @@ static bool handleGiveSem(int size, const byte *msg, CONTEXT *context)
         uint8_t reg;
 
         reg = lock();
-        // Semaphore is already full, do nothing
-        if (semaphores[id].full)
+        // Semaphore has a task waiting, hand it to the first and ready it
+        if (semaphores[id].firstWaiter)
             {
+            TASK* task = semaphores[id].firstWaiter;
+
+            removeWaiter(task);
+            if (task->waitTimed)
+                {
+                byte takeReply[3];
+
+                takeReply[0] = EXPR_BOOL;
+                takeReply[1] = EXPR_LIT;
+                takeReply[2] = true;
+                sendReply(sizeof(takeReply), SCHED_RESP_TAKE_SEM, 
+                          takeReply, task->context, task->waitBind);
+                }
+            armTask(task, micros(), 0, 0);
+            readyTask(task);
             }
-        // Semaphore has a task waiting, ready it to run 
-        else if (semaphores[id].waiting)
+        // Otherwise count it, up to the limit of the count
+        else if (semaphores[id].count != 0xFFFF)
             {
-            TASK* task = semaphores[id].waiting;
+            semaphores[id].count++;
+            }
+        unlock(reg);
+        }
+        return false;
+    }
+
+// Queue slots hold values as literals laid out like a bind, so a value 
+// can be copied between a bind and a queue as it is.  Only scalar types
+// can be queued.
+static bool evalQueueValue(byte **ppExpr, CONTEXT *context, byte *slot)
+    {
+    uint16_t w16Val;
+    uint32_t w32Val;
+    float fVal;
+
+    slot[0] = **ppExpr;
+    slot[1] = EXPR_LIT;
+    switch (slot[0])
+        {
+        case EXPR_BOOL:
+            slot[2] = evalBoolExpr(ppExpr, context);
+            break;
+        case EXPR_WORD8:
+            slot[2] = evalWord8Expr(ppExpr, context);
+            break;
+        case EXPR_INT8:
+            slot[2] = evalInt8Expr(ppExpr, context);
+            break;
+        case EXPR_WORD16:
+            w16Val = evalWord16Expr(ppExpr, context);
+            memcpy(&slot[2], &w16Val, sizeof(w16Val));
+            break;
+        case EXPR_INT16:
+            w16Val = evalInt16Expr(ppExpr, context);
+            memcpy(&slot[2], &w16Val, sizeof(w16Val));
+            break;
+        case EXPR_WORD32:
+            w32Val = evalWord32Expr(ppExpr, context);
+            memcpy(&slot[2], &w32Val, sizeof(w32Val));
+            break;
+        case EXPR_INT32:
+            w32Val = evalInt32Expr(ppExpr, context);
+            memcpy(&slot[2], &w32Val, sizeof(w32Val));
+            break;
+        case EXPR_FLOAT:
+            fVal = evalFloatExpr(ppExpr, context);
+            memcpy(&slot[2], &fVal, sizeof(fVal));
+            break;
+        default:
+            return false;
+        }
+    return true;
+    }
+
+static byte queueValueSize(const byte *slot)
+    {
+    switch (slot[0])
+        {
+        case EXPR_WORD16:
+        case EXPR_INT16:
+            return 4;
+        case EXPR_WORD32:
+        case EXPR_INT32:
+        case EXPR_FLOAT:
+            return 6;
+        default:
+            return 3;
+        }
+    }
+
+static byte *queueSlot(QUEUE *queue, byte index)
+    {
+    return &queue->slots[((queue->head + index) % queue->capacity) * 
+                         BIND_SPACING];
+    }
+
+static bool handleQueueCreate(int size, const byte *msg, CONTEXT *context)
+    {
+    byte *expr = (byte *) &msg[1];
+    byte id = evalWord8Expr(&expr, context);
+    byte capacity = evalWord8Expr(&expr, context);
+    byte *slots;
+
+    // A queue can not be replaced while tasks are waiting on it
+    if (id < NUM_QUEUES && capacity != 0 && 
+        queues[id].firstWaiter == NULL &&
+        (slots = (byte *) malloc(capacity * BIND_SPACING)) != NULL)
+        {
+        free(queues[id].slots);
+        queues[id].slots = slots;
+        queues[id].capacity = capacity;
+        queues[id].count = 0;
+        queues[id].head = 0;
+        }
+    return false;
+    }
+
+static bool handleQueueSend(int size, const byte *msg, CONTEXT *context)
+    {
+    byte bind = msg[1];
+    byte *expr = (byte *) &msg[2];
+    byte id = evalWord8Expr(&expr, context);
+    bool block = evalBoolExpr(&expr, context);
+    TASK *task = context->task;
+    byte value[BIND_SPACING];
+    byte sendReply[3];
 
-            task->ready = true;
-            task->millis = millis();
-            semaphores[id].waiting = NULL;
+    sendReply[0] = EXPR_BOOL;
+    sendReply[1] = EXPR_LIT;
+    sendReply[2] = false;
+
+    if (id < NUM_QUEUES && queues[id].slots != NULL &&
+        evalQueueValue(&expr, context, value))
+        {
+        QUEUE *queue = &queues[id];
+        uint8_t reg = lock();
+
+        if (queue->count == 0 && queue->firstWaiter != NULL)
+            {
+            // A task is waiting to receive, hand the value straight to it
+            TASK *receiver = queue->firstWaiter;
+
+            removeWaiter(receiver);
+            ::sendReply(queueValueSize(value), SCHED_RESP_QUEUE_RECV, value,
+                        receiver->context, receiver->waitBind);
+            armTask(receiver, micros(), 0, 0);
+            readyTask(receiver);
+            sendReply[2] = true;
             }
-        // Otherwise mark the semphore as full
-        else
+        else if (queue->count < queue->capacity)
+            {
+            memcpy(queueSlot(queue, queue->count), value, BIND_SPACING);
+            queue->count++;
+            sendReply[2] = true;
+            }
+        else if (block && task)
+            {
+            // Keep the value in the task's bind until there is room for it
+            memcpy(&context->bind[bind * BIND_SPACING], value, BIND_SPACING);
+            task->waitBind = bind;
+            task->waitQueue = id;
+            appendWaiter(&queue->firstWaiter, &queue->lastWaiter, task);
+            unreadyTask(task);
+            unlock(reg);
+            return true;
+            }
+        unlock(reg);
+        }
+
+    ::sendReply(sizeof(sendReply), SCHED_RESP_QUEUE_SEND, sendReply, 
+                context, bind);
+    return false;
+    }
+
+static bool handleQueueRecv(int size, const byte *msg, CONTEXT *context)
+    {
+    byte bind = msg[1];
+    byte *expr = (byte *) &msg[2];
+    byte id = evalWord8Expr(&expr, context);
+    bool block = evalBoolExpr(&expr, context);
+    TASK *task = context->task;
+    byte value[BIND_SPACING];
+
+    // The default value is the reply if there is nothing to receive
+    if (!evalQueueValue(&expr, context, value))
+        {
+        sendReply(0, SCHED_RESP_QUEUE_RECV, value, context, bind);
+        return false;
+        }
+
+    if (id < NUM_QUEUES && queues[id].slots != NULL)
+        {
+        QUEUE *queue = &queues[id];
+        uint8_t reg = lock();
+
+        if (queue->count != 0)
             {
-            semaphores[id].full = true;
+            memcpy(value, queueSlot(queue, 0), BIND_SPACING);
+            queue->head = (queue->head + 1) % queue->capacity;
+            queue->count--;
+
+            if (queue->firstWaiter != NULL)
+                {
+                // A task is waiting to send, move its value into the queue
+                TASK *sender = queue->firstWaiter;
+                byte *senderBind = 
+                    &sender->context->bind[sender->waitBind * BIND_SPACING];
+                byte sentReply[3];
+
+                removeWaiter(sender);
+                memcpy(queueSlot(queue, queue->count), senderBind, 
+                       BIND_SPACING);
+                queue->count++;
+                sentReply[0] = EXPR_BOOL;
+                sentReply[1] = EXPR_LIT;
+                sentReply[2] = true;
+                sendReply(sizeof(sentReply), SCHED_RESP_QUEUE_SEND, 
+                          sentReply, sender->context, sender->waitBind);
+                armTask(sender, micros(), 0, 0);
+                readyTask(sender);
+                }
+            }
+        else if (block && task)
+            {
+            task->waitBind = bind;
+            task->waitQueue = id;
+            appendWaiter(&queue->firstWaiter, &queue->lastWaiter, task);
+            unreadyTask(task);
+            unlock(reg);
+            return true;
             }
         unlock(reg);
         }
+
+    sendReply(queueValueSize(value), SCHED_RESP_QUEUE_RECV, value, 
+              context, bind);
+    return false;
+    }
+
+// Start streaming the code of a task which has already been created.  The
+// task's code is discarded, and the task is not run until it is scheduled
+// again, once the stream has completed.  The reply opens the stream, or 
+// ends it at once if the task can not take the code.
+static bool handleStreamTask(int size, const byte *msg, CONTEXT *context)
+    {
+    byte *expr = (byte *) &msg[1];
+    byte id = evalWord8Expr(&expr, context);
+    uint16_t length = evalWord16Expr(&expr, context);
+    uint16_t crc = evalWord16Expr(&expr, context);
+    TASK *task = findTask(id);
+    bool replacing = task != NULL && task->shadow != NULL;
+    byte status = false;
+
+    // The stream is written from the communication layer, so it may only 
+    // be started by the host.
+    if (context->task != NULL)
+        {
+        return false;
+        }
+
+    if (replacing)
+        {
+        // The task keeps running while its replacement is streamed
+        task = task->shadow;
+        }
+    if (task == NULL || length > task->size
+#ifdef BOOT_IMAGE_FLASH
+        || task->flashData != NULL
+#endif
+        )
+        {
+        streamTask = NULL;
+        sendReply(sizeof(status), STREAM_RESP_END, &status, context, 0);
+        return false;
+        }
+
+    if (!replacing)
+        {
+        // The task starts its new code from the top, as a new task would
+        unreadyTask(task);
+        if (task->waitSem != NO_SEMAPHORE || task->waitQueue != NO_QUEUE)
+            {
+            uint8_t reg = lock();
+            removeWaiter(task);
+            unlock(reg);
+            }
+        task->rescheduled = false;
+        task->context->currBlockLevel = -1;
+        task->context->recallBlockLevel = -1;
+        }
+    task->currLen = 0;
+    task->currPos = 0;
+    streamTask = task;
+    streamLength = length;
+    streamCrc = crc;
+    openTaskStream();
+    return false;
+    }
+
+TASK *schedulerStreamTask(uint16_t *room)
+    {
+    if (streamTask != NULL)
+        {
+        *room = streamLength - streamTask->currLen;
+        }
+    return streamTask;
+    }
+
+// Close the stream once all of the task's code has been written, and 
+// check it against the CRC it was started with.  Code which fails the 
+// check is discarded.
+bool schedulerEndStream()
+    {
+    TASK *task = streamTask;
+
+    streamTask = NULL;
+    if (task == NULL)
+        {
+        return false;
+        }
+    if (bootCrc(SEQ_CRC_INIT, task->data, task->currLen) != streamCrc)
+        {
+        task->currLen = 0;
         return false;
+        }
+    return true;
     }
 
+#ifdef BOOT_IMAGE_FLASH
+// Boot the tasks of the image built into the firmware, and run them in 
+// place.  The image is a task count, followed by a record for each task,
+// as in the EEPROM image, and its body, which is never packed.
+static void bootFlashTasks()
+    {
+    const byte *image = bootImageFlash;
+    byte taskCount = pgm_read_byte(image++);
+
+    for (unsigned int t=0; t<taskCount; t++)
+        {
+        BOOT_RECORD record;
+        TASK *task;
+
+        memcpy_P(&record, image, sizeof(record));
+        image += sizeof(record);
+
+        // The task has no code of its own in the arena
+        createById(record.id, 0, record.bindSize);
+        if ((task = findTask(record.id)) == NULL || task->size != 0)
+            {
+            break;
+            }
+        task->flashData = image;
+        task->currLen = record.taskLen;
+        image += record.storedLen;
+        scheduleById(record.id, record.startMillis);
+        }
+    }
+#endif
+
 void schedulerBootTask()
     {
-    if (EEPROM[ 0 ] == 'H' && EEPROM[ 1 ] == 'A' &&
-        EEPROM[ 2 ] == 'S' && EEPROM[ 3 ] == 'K')
+    BOOT_HEADER header;
+    uint16_t index = sizeof(BOOT_HEADER);
+
+#ifdef BOOT_IMAGE_FLASH
+    bootFlashTasks();
+#endif
+    if (!readBootHeader(&header))
+        {
+        return;
+        }
+
+    for (unsigned int t=0; t<header.taskCount; t++)
         {
+        BOOT_RECORD record;
         TASK *task;
-        unsigned int taskCount = EEPROM[ 4 ];
-        unsigned int index = BOOT_TASK_INDEX_START;
-
-        for (unsigned int t=0; t<taskCount; t++)
-            {
-            uint32_t low, high, midl, midh;
-            uint16_t taskSize, bindSize;
-            uint32_t taskMillis;
-            byte id = EEPROM[ index++ ];
-
-            low = EEPROM[ index++ ];
-            high = EEPROM[ index++ ];
-            taskSize = low | high << 8;
-            low = EEPROM[ index++ ];
-            high = EEPROM[ index++ ];
-            bindSize = low | high << 8;
-            low = EEPROM[ index++ ];
-            midl = EEPROM[ index++ ];
-            midh = EEPROM[ index++ ];
-            high = EEPROM[ index++ ];
-            taskMillis = low | midl << 8 | midh << 16 | high << 24;
-
-            createById(id, taskSize, bindSize);
-            task = findTask(id);
-            for (unsigned int i=0;i<taskSize;i++,index++)
-                {
-                task->data[i] = EEPROM[ index ];
-                }
-            task->currLen = taskSize;           
-            scheduleById(id, taskMillis);
+
+        eeprom_read_block(&record, (const void *) (uintptr_t) index, 
+                          sizeof(record));
+        index += sizeof(record);
+
+        createById(record.id, record.taskLen, record.bindSize);
+        if ((task = findTask(record.id)) == NULL)
+            {
+            // No room left in the task arena for the rest
+            break;
             }
+        if (task->size < record.taskLen)
+            {
+            // A task of the same id was already booted from flash
+            index += record.storedLen;
+            continue;
+            }
+        if (record.flags & BOOT_RECORD_PACKED)
+            {
+            unpackBootBody(index, task->data, record.taskLen);
+            }
+        else
+            {
+            eeprom_read_block(task->data, (const void *) (uintptr_t) index,
+                              record.taskLen);
+            }
+        index += record.storedLen;
+        task->currLen = record.taskLen;
+        scheduleById(record.id, record.startMillis);
         }
     }
 
 void schedulerRunTasks()
     {
-    if (firstTask) 
+    unsigned long now;
+    int runs;
+    TASK *current;
+    bool rescheduled;
+    uint8_t reg;
+#ifdef INCLUDE_TASK_STATS
+    uint32_t start;
+#endif
+
+    if (arenaHoles)
         {
-        unsigned long now = millis();
-        TASK *current = firstTask;
-        TASK *next = NULL;
+        compactArena();
+        }
+    dispatchIsrEvents();
+    now = micros();
+    runs = taskCount;
 
-        while (current) 
+    // Each pass runs at most as many tasks as exist, so a task which 
+    // yields with its deadline already passed can not starve the loop.
+    while (runs-- > 0)
+        {
+        reg = lock();
+        current = readyList;
+        if (current == NULL || 
+            (int32_t) (now - current->wake) < 0)
+            {
+            unlock(reg);
+            break;
+            }
+        readyList = current->readyNext;
+        if (current->holdMillis != 0)
             {
-            next = current->next;
-            if (current->ready && 
-                now - current->millis < 0x80000000UL)
+            // The first part of a long delay has passed, arm the rest
+            armTask(current, current->wake, current->holdMillis, 0);
+            queueTask(current);
+            unlock(reg);
+            continue;
+            }
+        // A task still waiting on a semaphore has timed out, or was 
+        // scheduled while it waited
+        if (current->waitSem != NO_SEMAPHORE || 
+            current->waitQueue != NO_QUEUE)
+            {
+            removeWaiter(current);
+            }
+        // Replacement code is swapped in between runs of a task
+        if (current->shadow != NULL && !current->rescheduled)
+            {
+            current = swapTask(current);
+            }
+        runningTask = current;
+        unlock(reg);
+
+        // A periodic task's release is the deadline it was due at, not 
+        // when it got to run, so its period does not drift.
+        if (current->period != 0 && !current->rescheduled)
+            {
+            current->release = current->wake;
+            }
+
+#ifdef INCLUDE_TASK_BUDGET
+        current->sliceStart = micros();
+#endif
+#ifdef INCLUDE_TASK_STATS
+        start = micros();
+        if (!current->rescheduled)
+            {
+            recordTaskStart(current, start - current->wake);
+            }
+#endif
+#ifdef BOOT_IMAGE_FLASH
+        if (current->flashData != NULL)
+            rescheduled = runCodeBlock(current->currLen, 
+                                       current->flashData, current->context);
+        else
+#endif
+        rescheduled = runCodeBlock(current->currLen, 
+                                   current->data, current->context);
+
+        // The task deleted itself, and its block is now a hole which must
+        // be neither re-armed nor put back on the ready list.
+        if (current->context == NULL)
+            {
+            runningTask = NULL;
+            if (current->inHeap)
+                {
+                free(current);
+                }
+            continue;
+            }
+#ifdef INCLUDE_TASK_STATS
+        recordTaskRun(current, micros() - start);
+#endif
+
+        if (!rescheduled)
+            {
+            if (current->period == 0 && !isInterruptTask(current))
                 {
-                runningTask = current;
-                if (!runCodeBlock(current->currLen, 
-                                  current->data, current->context))
-                    {
-                    deleteTask(current);
-                    }
                 runningTask = NULL;
+                deleteTask(current);
+                continue;
+                }
+            reg = lock();
+            runningTask = NULL;
+            if (current->period != 0)
+                {
+                rearmPeriodicTask(current);
                 }
-            current = next;
+            else if (current->pendingEvents != 0)
+                {
+                // Interrupts came in while the task was running
+                current->pendingEvents--;
+                armTask(current, micros(), 0, 0);
+                }
+            else
+                {
+                current->ready = false;
+                }
+            if (current->ready)
+                {
+                queueTask(current);
+                }
+            unlock(reg);
             }
+        else
+            {
+            reg = lock();
+            runningTask = NULL;
+            if (current->ready)
+                {
+                queueTask(current);
+                }
+            unlock(reg);
+            }
+        }
+    }
+
+#ifdef INCLUDE_TASK_STATS
+static void recordTaskStart(TASK *task, uint32_t latency)
+    {
+    byte bin = 0;
+    uint16_t *count;
+
+    if (task->stats.activations != 0xFFFFFFFFUL)
+        {
+        task->stats.activations++;
+        }
+
+    latency >>= STATS_HIST_SHIFT;
+    while (latency != 0 && bin < STATS_HIST_BINS - 1)
+        {
+        latency >>= 1;
+        bin++;
+        }
+    count = &task->stats.startLatency[bin];
+    if (*count != 0xFFFF)
+        {
+        (*count)++;
         }
     }
 
+// The time of each run of a task is counted, so a task which yields is 
+// charged for each part, and its longest run is how long it held off the
+// rest of the loop.
+static void recordTaskRun(TASK *task, uint32_t elapsed)
+    {
+    if (elapsed > 0xFFFFFFFFUL - task->stats.runMicros)
+        {
+        task->stats.runMicros = 0xFFFFFFFFUL;
+        }
+    else
+        {
+        task->stats.runMicros += elapsed;
+        }
+    if (elapsed > task->stats.maxRunMicros)
+        {
+        task->stats.maxRunMicros = elapsed;
+        }
+    }
+#endif
+
+// Re-arm a periodic task which has finished an activation for its next
+// release.  If that release has already passed the task has overrun, and
+// it is run once for the latest release it missed, so it keeps its phase
+// without a burst of catch up activations.
+static void rearmPeriodicTask(TASK *task)
+    {
+    uint32_t next = task->release + task->period;
+    uint32_t late = micros() - next;
+
+    if ((int32_t) late >= 0)
+        {
+        uint32_t missed = late / task->period;
+
+        next += missed * task->period;
+        missed++;
+        if (missed > (uint32_t) (0xFFFF - task->overruns))
+            {
+            task->overruns = 0xFFFF;
+            }
+        else
+            {
+            task->overruns += missed;
+            }
+        }
+    task->wake = next;
+    task->holdMillis = 0;
+    }
+
+unsigned long schedulerIdleMillis()
+    {
+    unsigned long next, hold;
+    long wait;
+    uint8_t reg = lock();
+
+    if (isrEventTail != isrEventHead)
+        {
+        unlock(reg);
+        return 0;
+        }
+    if (readyList == NULL)
+        {
+        unlock(reg);
+        return SCHED_NO_DEADLINE;
+        }
+    next = readyList->wake;
+    hold = readyList->holdMillis;
+    unlock(reg);
+
+    // Less than a millisecond to go counts as due
+    wait = (long) (next - micros());
+    return wait > 0 ? (unsigned long) wait / 1000 + hold : 0;
+    }
+
 bool isRunningTask()
     {
     return runningTask != NULL;
@@ -642,16 +2119,67 @@ bool isRunningTask()
 
 void delayRunningTask(unsigned long ms)
     {
-    runningTask->millis = millis() + ms; 
+    armTask(runningTask, micros(), ms, 0);
+    }
+
+void delayRunningTaskMicros(unsigned long us)
+    {
+    armTask(runningTask, micros(), 0, us);
+    }
+
+static bool isInterruptTask(TASK *task)
+    {
+    for (int i = 0; i < MAX_INTERRUPTS; i++)
+        {
+        if (intTasks[i] == task)
+            {
+            return true;
+            }
+        }
+    return false;
+    }
+
+// Ready the tasks attached to the interrupts recorded since the last pass,
+// with the time of the interrupt as their deadline.  An interrupt for a 
+// task which is already waiting to run is counted, and the task is run 
+// again once it finishes.
+static void dispatchIsrEvents()
+    {
+    byte tail = isrEventTail;
+
+    while (tail != isrEventHead)
+        {
+        ISR_EVENT *event = &isrEvents[tail];
+        TASK *task = intTasks[event->intNum];
+
+        if (task != NULL)
+            {
+            if (!task->ready && task != runningTask)
+                {
+                armTask(task, event->time, 0, 0);
+                readyTask(task);
+                }
+            else if (task->pendingEvents != 0xFF)
+                {
+                task->pendingEvents++;
+                }
+            }
+        tail = (tail + 1) & ISR_EVENT_QUEUE_MASK;
+        isrEventTail = tail;
+        }
     }
 
 static void handleISR(int intNum)
     {
-    TASK *task = intTasks[intNum];
+    byte head = isrEventHead;
+    byte next = (head + 1) & ISR_EVENT_QUEUE_MASK;
 
-    if (task)
+    // If the queue is full the interrupt is dropped
+    if (next != isrEventTail)
         {
-        runCodeBlock(task->currLen, task->data, task->context);
+        isrEvents[head].intNum = intNum;
+        isrEvents[head].time = micros();
+        isrEventHead = next;
         }
     }
 
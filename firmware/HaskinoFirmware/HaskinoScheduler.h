@@ -15,19 +15,56 @@ typedef struct block_status_t
         } info;
     } BLOCK_STATUS;
 
+// Per task run statistics.  startLatency is a histogram of the time from
+// the deadline a task was due at to when it started, with the bins of the
+// protocol latency histograms.  The structure is sent as is, following the
+// task information, in the SCHED_RESP_QUERY reply.
+typedef struct task_stats_t
+    {
+    uint32_t            activations;
+    uint32_t            runMicros;
+    uint32_t            maxRunMicros;
+    uint16_t            startLatency[STATS_HIST_BINS];
+    } TASK_STATS;
+
 typedef struct task_t 
     {
     struct task_t      *next;
     struct task_t      *prev;
+    struct task_t      *hashNext;
+    struct task_t      *readyNext;
+    struct task_t      *waitNext;
+    struct task_t      *shadow;
     struct context_t   *context;
     byte                id;
+    uint16_t            blockSize;
     uint16_t            size;
     uint16_t            currLen;
     uint16_t            currPos;
-    uint32_t            millis;
-    bool                ready;
-    bool                rescheduled;
-    byte               *endData;
+    uint32_t            wake;
+    uint32_t            holdMillis;
+    uint32_t            period;
+    uint32_t            release;
+#ifdef INCLUDE_TASK_BUDGET
+    uint32_t            budget;
+    uint32_t            sliceStart;
+#endif
+    uint16_t            overruns;
+    byte                pendingEvents;
+    byte                waitSem;
+    byte                waitQueue;
+    byte                waitBind;
+    bool                waitTimed : 1;
+    bool                ready : 1;
+    bool                rescheduled : 1;
+    bool                keepBinds : 1;
+    bool                inHeap : 1;
+#ifdef INCLUDE_TASK_STATS
+    TASK_STATS          stats;
+#endif
+#ifdef BOOT_IMAGE_FLASH
+    const byte         *flashData;
+#endif
     byte                data[];
     } TASK;
 
@@ -44,16 +81,44 @@ typedef struct context_t
 
 typedef struct semphore_t
     {
-    bool full;
-    TASK *waiting;
+    uint16_t count;
+    TASK *firstWaiter;
+    TASK *lastWaiter;
     } SEMAPHORE;
 
+typedef struct queue_t
+    {
+    byte *slots;
+    byte capacity;
+    byte count;
+    byte head;
+    TASK *firstWaiter;
+    TASK *lastWaiter;
+    } QUEUE;
+
+typedef struct arena_stats_t
+    {
+    uint16_t size;
+    uint16_t free;
+    uint16_t largest;
+    uint16_t failures;
+    } ARENA_STATS;
+
 bool parseSchedulerMessage(int size, const byte *msg, CONTEXT *context);
+bool parseSchedulerExtMessage(int size, const byte *msg, CONTEXT *context);
 CONTEXT *schedulerDefaultContext();
 void schedulerBootTask();
 void schedulerRunTasks();
 bool isRunningTask();
 int getTaskCount();
 void delayRunningTask(unsigned long ms);
+void delayRunningTaskMicros(unsigned long us);
+unsigned long schedulerIdleMillis();
+void schedulerArenaStats(ARENA_STATS *stats);
+TASK *schedulerStreamTask(uint16_t *room);
+bool schedulerEndStream();
+
+// Returned by schedulerIdleMillis() when no task is ready
+#define SCHED_NO_DEADLINE   0xFFFFFFFFUL
 
 #endif /* HaskinoSchedulerH */
@@ -13,29 +13,21 @@ static bool handleWriteList(int size, const byte *msg, CONTEXT *context);
 static bool handleRead(int size, const byte *msg, CONTEXT *context);
 static bool handleReadList(int size, const byte *msg, CONTEXT *context);
 
-void    {
-    switch (msg[0] )
-        {
-        case SER_CMD_BEGIN:
-            return handleBegin(size, msg, context);
-            break;
-        case SER_CMD_END:
-            return handleEnd(size, msg, context);
-            break;
-        case SER_CMD_WRITE:
-            return handleWrite(size, msg, context);
-            break;
-        case SER_CMD_WRITE_LIST:
-            return handleWriteList(size, msg, context);
-            break;
-        case SER_CMD_READ:
-            return handleRead(size, msg, context);
-            break;
-        case SER_CMD_READ_LIST:
-            return handleReadList(size, msg, context);
-            break;
-        }
-    return false;
+static const MessageHandler serialHandlers[] PROGMEM =
+    {
+    handleBegin,             // SER_CMD_BEGIN
+    handleEnd,               // SER_CMD_END
+    NULL,                    // SER_CMD_AVAIL, not supported
+    handleRead,              // SER_CMD_READ
+    handleReadList,          // SER_CMD_READ_LIST
+    handleWrite,             // SER_CMD_WRITE
+    handleWriteList,         // SER_CMD_WRITE_LIST
+    };
+
+bool parseSerialMessage(int size, const byte *msg, CONTEXT *context)
+    {
+    return dispatchMessage(serialHandlers, DISPATCH_SIZE(serialHandlers),
+                           size, msg, context);
     }
 
 static HardwareSerial *getDev(uint8_t p)
@@ -18,30 +18,20 @@ static bool handleWriteMicros(int size, const byte *msg, CONTEXT *context);
 static bool handleRead(int size, const byte *msg, CONTEXT *context);
 static bool handleReadMicros(int size, const byte *msg, CONTEXT *context);
 
-void parseServoMessage(int size, const byte *msg, CONTEXT *context)
+static const MessageHandler servoHandlers[] PROGMEM =
     {
-    switch (msg[0]) 
-        {
-        case SRVO_CMD_ATTACH:
-            handleAttach(size, msg, context);
-            break;
-        case SRVO_CMD_DETACH:
-            handleDetach(size, msg, context);
-            break;
-        case SRVO_CMD_WRITE:
-            handleWrite(size, msg, context);
-            break;
-        case SRVO_CMD_WRITE_MICROS:
-            handleWriteMicros(size, msg, context);
-            break;
-        case SRVO_CMD_READ:
-            handleRead(size, msg, context);
-            break;
-        case SRVO_CMD_READ_MICROS:
-            handleReadMicros(size, msg, context);
-            break;
-        }
-    return false;
+    handleAttach,            // SRVO_CMD_ATTACH
+    handleDetach,            // SRVO_CMD_DETACH
+    handleWrite,             // SRVO_CMD_WRITE
+    handleWriteMicros,       // SRVO_CMD_WRITE_MICROS
+    handleRead,              // SRVO_CMD_READ
+    handleReadMicros,        // SRVO_CMD_READ_MICROS
+    };
+
+bool parseServoMessage(int size, const byte *msg, CONTEXT *context)
+    {
+    return dispatchMessage(servoHandlers, DISPATCH_SIZE(servoHandlers),
+                           size, msg, context);
     }
 
 static bool handleAttach(int size, const byte *msg, CONTEXT *context)
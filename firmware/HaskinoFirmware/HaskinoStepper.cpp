@@ -16,24 +16,18 @@ static bool handle4Pin(int size, const byte *msg, CONTEXT *context);
 static bool handleSetSpeed(int size, const byte *msg, CONTEXT *context);
 static bool handleStep(int size, const byte *msg, CONTEXT *context);
 
+static const MessageHandler stepperHandlers[] PROGMEM =
+    {
+    handle2Pin,              // STEP_CMD_2PIN
+    handle4Pin,              // STEP_CMD_4PIN
+    handleSetSpeed,          // STEP_CMD_SET_SPEED
+    handleStep,              // STEP_CMD_STEP
+    };
+
 bool parseStepperMessage(int size, const byte *msg, CONTEXT *context)
     {
-    switch (msg[0]) 
-        {
-        case STEP_CMD_2PIN:
-            handle2Pin(size, msg, context);
-            break;
-        case STEP_CMD_4PIN:
-            handle4Pin(size, msg, context);
-            break;
-        case STEP_CMD_SET_SPEED:
-            handleSetSpeed(size, msg, context);
-            break;
-        case STEP_CMD_STEP:
-            handleStep(size, msg, context);
-            break;
-        }
-    return false;
+    return dispatchMessage(stepperHandlers, DISPATCH_SIZE(stepperHandlers),
+                           size, msg, context);
     }
 
 static bool handle2Pin(int size, const byte *msg, CONTEXT *context)
@@ -0,0 +1,43 @@
+-------------------------------------------------------------------------------
+-- |
+-- Module      :  Main
+-- Copyright   :  (c) University of Kansas
+-- License     :  BSD3
+-- Stability   :  experimental
+--
+-- Burst receive timing.  Sends bursts of back to back digitalWrite commands
+-- followed by a queryFirmware procedure, so the firmware receives several
+-- frames before it has to reply.  Compare firmware builds with the per
+-- byte receive path and the ring buffer receive path.
+-------------------------------------------------------------------------------
+module Main where
+
+import Control.Monad (forM_, replicateM_)
+import Control.Monad.Trans (liftIO)
+import Data.Time.Clock (diffUTCTime, getCurrentTime)
+import System.Hardware.Haskino
+
+burstSize :: Int
+burstSize = 8
+
+iterations :: Int
+iterations = 1000
+
+burst :: Arduino ()
+burst = do
+    forM_ [1..burstSize] $ \i -> digitalWrite 2 (odd i)
+    _ <- queryFirmware
+    return ()
+
+prog :: Arduino ()
+prog = do
+    start <- liftIO getCurrentTime
+    replicateM_ iterations burst
+    end <- liftIO getCurrentTime
+    let total = realToFrac (diffUTCTime end start) * 1000 :: Double
+    liftIO $ putStrLn $ show burstSize ++ " digitalWrite - 1 queryFirmware " ++
+                        show iterations ++ " times: " ++ show total ++ " ms, " ++
+                        show (total / fromIntegral iterations) ++ " ms/burst"
+
+main :: IO ()
+main = withArduino False "/dev/cu.usbmodem1421" prog
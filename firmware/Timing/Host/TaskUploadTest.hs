@@ -0,0 +1,66 @@
+-------------------------------------------------------------------------------
+-- |
+-- Module      :  Main
+-- Copyright   :  (c) University of Kansas
+-- License     :  BSD3
+-- Stability   :  experimental
+--
+-- Task upload timing.  Creates a number of small resident tasks, and then
+-- repeatedly uploads and deletes a large task, which is sent as a create
+-- followed by many SCHED_CMD_ADD_TO_TASK chunks.  Each chunk looks up the
+-- task by id, so compare firmware builds with the task list scan and the
+-- task table lookup as the number of resident tasks grows.  The resident
+-- tasks and the uploaded task together fit the Mega's 3K task arena, and
+-- each upload is checked to have completed before it is deleted.  On the
+-- Mega every id has its own table slot, while on boards with a 16 slot
+-- table the upload id 250 shares the slot of resident task 10.
+-------------------------------------------------------------------------------
+module Main where
+
+import Control.Monad (forM_, replicateM_)
+import Control.Monad.Trans (liftIO)
+import Data.Time.Clock (diffUTCTime, getCurrentTime)
+import Data.Word (Word8)
+import System.Hardware.Haskino
+
+residentTasks :: Word8
+residentTasks = 12
+
+bodyCommands :: Int
+bodyCommands = 100
+
+iterations :: Int
+iterations = 50
+
+uploadId :: TaskID
+uploadId = 250
+
+body :: Arduino ()
+body = forM_ [1..bodyCommands] $ \i -> digitalWrite 2 (odd i)
+
+upload :: Arduino ()
+upload = do
+    createTask uploadId body
+    -- Waits for the upload to complete before starting the next one
+    q <- queryTask uploadId
+    case q of
+      Just (size, len, _, _) | size == len -> return ()
+      _ -> liftIO $ fail "Task upload failed, the task did not fit"
+    deleteTask uploadId
+
+prog :: Arduino ()
+prog = do
+    scheduleReset
+    forM_ [1..residentTasks] $ \t -> createTask t (digitalWrite 3 True)
+    start <- liftIO getCurrentTime
+    replicateM_ iterations upload
+    end <- liftIO getCurrentTime
+    let total = realToFrac (diffUTCTime end start) * 1000 :: Double
+    liftIO $ putStrLn $ show bodyCommands ++ " command task upload with " ++
+                        show residentTasks ++ " resident tasks " ++
+                        show iterations ++ " times: " ++ show total ++ " ms, " ++
+                        show (total / fromIntegral iterations) ++ " ms/upload"
+    scheduleReset
+
+main :: IO ()
+main = withArduino False "/dev/cu.usbmodem1421" prog